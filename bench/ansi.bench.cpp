@@ -0,0 +1,118 @@
+#include <ferrugo/ansi/default_context.hpp>
+#include <ferrugo/ansi/element.hpp>
+
+#include "bench.hpp"
+
+namespace bench
+{
+
+namespace
+{
+
+namespace fa = ferrugo::ansi;
+
+const fa::element_t new_line = [](fa::context_t& ctx) { ctx.new_line(); };
+
+fa::list_item_formatter_t list_item_formatter(std::size_t)
+{
+    return [](fa::context_t& ctx, const fa::list_state_t& state)
+    { ctx.write_text(fa::mb_string(std::to_string(state.back() + 1) + ". ")); };
+}
+
+fa::detail::style_applier_fn level_style(const std::string& level)
+{
+    if (level == "error")
+    {
+        return fa::fg[fa::basic_color_t::red] | fa::bold;
+    }
+    if (level == "warn")
+    {
+        return fa::fg[fa::basic_color_t::yellow];
+    }
+    return fa::fg[fa::basic_color_t::green];
+}
+
+fa::element_t nested_map(const corpus_t& c)
+{
+    std::vector<fa::element_t> items;
+    for (const auto& [k, inner] : c.nested_map)
+    {
+        items.push_back(fa::block(fa::fg[fa::basic_color_t::blue](k), std::string{ ": {" }, new_line));
+        for (const auto& [ik, iv] : inner)
+        {
+            items.push_back(fa::block(
+                fa::fg[fa::basic_color_t::blue](ik),
+                std::string{ ": " },
+                fa::fg[fa::bright_color_t::white](iv),
+                new_line));
+        }
+        items.push_back(fa::block(std::string{ "}" }, new_line));
+    }
+    return fa::block(std::string{ "{" }, new_line, fa::block(std::move(items)), std::string{ "}" }, new_line);
+}
+
+fa::element_t long_log(const corpus_t& c)
+{
+    std::vector<fa::element_t> items;
+    for (const log_entry_t& e : c.long_log)
+    {
+        items.push_back(fa::block(
+            fa::dim(e.timestamp),
+            std::string{ " [" },
+            level_style(e.level)(e.level),
+            std::string{ "] " },
+            e.message,
+            new_line));
+    }
+    return fa::block(std::move(items));
+}
+
+fa::element_t deep_list(std::size_t depth, std::size_t level = 0)
+{
+    if (level == depth)
+    {
+        return fa::block();
+    }
+    return fa::list(
+        fa::block(std::string{ "item" }, new_line, deep_list(depth, level + 1)),
+        fa::block(std::string{ "tail" }, new_line));
+}
+
+fa::element_t style_heavy(const corpus_t& c)
+{
+    std::vector<fa::element_t> items;
+    for (std::size_t i = 0; i < c.style_heavy.size(); ++i)
+    {
+        const auto col = static_cast<fa::basic_color_t>(i % 8);
+        const auto f = (i % 3 == 0) ? fa::font_t::bold : (i % 3 == 1) ? fa::font_t::italic : fa::font_t::none;
+        items.push_back((fa::fg[col] | fa::font[f])(c.style_heavy[i]));
+        items.push_back(fa::detail::to_element(std::string{ " " }));
+        if (i % 16 == 15)
+        {
+            items.push_back(new_line);
+        }
+    }
+    return fa::block(std::move(items));
+}
+
+template <class Func>
+auto with_context(Func func) -> std::function<void(std::ostream&)>
+{
+    return [=](std::ostream& os)
+    {
+        fa::default_context_t ctx{ os, list_item_formatter };
+        ctx << func();
+    };
+}
+
+}  // namespace
+
+void register_cases(std::vector<case_t>& cases)
+{
+    cases.push_back({ "ansi", "nested_map", with_context([]() { return nested_map(corpus()); }) });
+    cases.push_back({ "ansi", "long_log", with_context([]() { return long_log(corpus()); }) });
+    cases.push_back({ "ansi", "deep_list", with_context([]() { return deep_list(corpus().deep_list_depth); }) });
+    cases.push_back({ "ansi", "style_heavy", with_context([]() { return style_heavy(corpus()); }) });
+}
+
+}  // namespace bench
@@ -0,0 +1,117 @@
+#include <ferrugo/ansi2/ostream_output.hpp>
+#include <ferrugo/ansi2/output_appliers.hpp>
+#include <memory>
+
+#include "bench.hpp"
+
+namespace bench
+{
+
+namespace
+{
+
+const ansi::font_style_t key_style{ ansi::basic_color_t::blue };
+const ansi::font_style_t value_style{ ansi::bright_color_t{ ansi::basic_color_t::white } };
+
+ansi::font_style_t level_style(const std::string& level)
+{
+    if (level == "error")
+    {
+        return ansi::font_style_t{ ansi::basic_color_t::red, {}, ansi::font_t::bold };
+    }
+    if (level == "warn")
+    {
+        return ansi::font_style_t{ ansi::basic_color_t::yellow };
+    }
+    return ansi::font_style_t{ ansi::basic_color_t::green };
+}
+
+void styled(ansi::output_t& out, const ansi::font_style_t& style, const std::string& text)
+{
+    out.push_font_style(style).write(text).pop_font_style();
+}
+
+void nested_map(ansi::output_t& out, const corpus_t& c)
+{
+    out.write("{").new_line().indent(2);
+    for (const auto& [k, inner] : c.nested_map)
+    {
+        styled(out, key_style, k);
+        out.write(": {").new_line().indent(2);
+        for (const auto& [ik, iv] : inner)
+        {
+            styled(out, key_style, ik);
+            out.write(": ");
+            styled(out, value_style, iv);
+            out.new_line();
+        }
+        out.unindent().write("}").new_line();
+    }
+    out.unindent().write("}").new_line();
+}
+
+void long_log(ansi::output_t& out, const corpus_t& c)
+{
+    for (const log_entry_t& e : c.long_log)
+    {
+        out.modify_font_style(ansi::font(ansi::font_t::dim)).write(e.timestamp).pop_font_style();
+        out.write(" [");
+        styled(out, level_style(e.level), e.level);
+        out.write("] ").write(e.message).new_line();
+    }
+}
+
+void deep_list(ansi::output_t& out, std::size_t depth, std::size_t level = 0)
+{
+    if (level == depth)
+    {
+        return;
+    }
+    out.write(std::to_string(level + 1) + ". item").new_line().indent(2);
+    deep_list(out, depth, level + 1);
+    out.unindent().write(std::to_string(level + 1) + ". tail").new_line();
+}
+
+void style_heavy(ansi::output_t& out, const corpus_t& c)
+{
+    for (std::size_t i = 0; i < c.style_heavy.size(); ++i)
+    {
+        const auto col = static_cast<ansi::basic_color_t>(i % 8);
+        const auto f = (i % 3 == 0) ? ansi::font_t::bold : (i % 3 == 1) ? ansi::font_t::italic : ansi::font_t::none;
+        styled(out, ansi::font_style_t{ col, {}, f }, c.style_heavy[i]);
+        out.write(" ");
+        if (i % 16 == 15)
+        {
+            out.new_line();
+        }
+    }
+}
+
+void large_text(ansi::output_t& out, const corpus_t& c)
+{
+    out.indent(2).write(c.large_text).unindent();
+}
+
+template <class Func>
+auto with_output(Func func) -> std::function<void(std::ostream&)>
+{
+    return [=](std::ostream& os)
+    {
+        ansi::output_t out{ std::make_unique<ansi::ostream_output_t>(os) };
+        func(out);
+    };
+}
+
+}  // namespace
+
+void register_cases(std::vector<case_t>& cases)
+{
+    cases.push_back({ "ansi2", "nested_map", with_output([](ansi::output_t& out) { nested_map(out, corpus()); }) });
+    cases.push_back({ "ansi2", "long_log", with_output([](ansi::output_t& out) { long_log(out, corpus()); }) });
+    cases.push_back(
+        { "ansi2", "deep_list", with_output([](ansi::output_t& out) { deep_list(out, corpus().deep_list_depth); }) });
+    cases.push_back({ "ansi2", "style_heavy", with_output([](ansi::output_t& out) { style_heavy(out, corpus()); }) });
+    cases.push_back({ "ansi2", "large_text", with_output([](ansi::output_t& out) { large_text(out, corpus()); }) });
+}
+
+}  // namespace bench
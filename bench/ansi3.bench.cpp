@@ -0,0 +1,507 @@
+#include <fcntl.h>
+#include <ferrugo/ansi3/compact_stream.hpp>
+#include <ferrugo/ansi3/fd_sink.hpp>
+#include <ferrugo/ansi3/frame_arena.hpp>
+#include <ferrugo/ansi3/html.hpp>
+#include <ferrugo/ansi3/mmap_sink.hpp>
+#include <ferrugo/ansi3/render_plan.hpp>
+#include <ferrugo/ansi3/serialize.hpp>
+#include <ferrugo/ansi3/static_document.hpp>
+#include <ferrugo/ansi3/stream.hpp>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+
+#include "bench.hpp"
+
+namespace bench
+{
+
+namespace
+{
+
+const ansi::font_style_t key_style{ ansi::basic_color_t::blue };
+const ansi::font_style_t value_style{ ansi::bright_color_t{ ansi::basic_color_t::white } };
+
+ansi::font_style_t level_style(const std::string& level)
+{
+    if (level == "error")
+    {
+        return ansi::font_style_t{ ansi::basic_color_t::red, {}, ansi::font_t::bold };
+    }
+    if (level == "warn")
+    {
+        return ansi::font_style_t{ ansi::basic_color_t::yellow };
+    }
+    return ansi::font_style_t{ ansi::basic_color_t::green };
+}
+
+ansi::stream_t nested_map(const corpus_t& c)
+{
+    ansi::stream_t result = ansi::line("{");
+    for (const auto& [k, inner] : c.nested_map)
+    {
+        ansi::stream_t items;
+        for (const auto& [ik, iv] : inner)
+        {
+            items << ansi::line(
+                ansi::set_style(key_style)(std::cref(ik)), ": ", ansi::set_style(value_style)(std::cref(iv)));
+        }
+        result << ansi::indented(
+            ansi::line(ansi::set_style(key_style)(std::cref(k)), ": {"), ansi::indented(std::move(items)), ansi::line("}"));
+    }
+    result << ansi::line("}");
+    return result;
+}
+
+ansi::stream_t long_log(const corpus_t& c)
+{
+    return ansi::map(
+        [](const log_entry_t& e)
+        {
+            return ansi::line(
+                ansi::change_style(ansi::font(ansi::font_t::dim))(std::cref(e.timestamp)),
+                " [",
+                ansi::set_style(level_style(e.level))(std::cref(e.level)),
+                "] ",
+                std::cref(e.message));
+        },
+        c.long_log);
+}
+
+ansi::stream_t deep_list(std::size_t depth, std::size_t level = 0)
+{
+    if (level == depth)
+    {
+        return ansi::stream_t{};
+    }
+    return ansi::stream_t{}(
+        ansi::line(static_cast<int>(level + 1), ". item"),
+        ansi::indented(deep_list(depth, level + 1)),
+        ansi::line(static_cast<int>(level + 1), ". tail"));
+}
+
+ansi::stream_t style_heavy(const corpus_t& c)
+{
+    ansi::stream_t result;
+    for (std::size_t i = 0; i < c.style_heavy.size(); ++i)
+    {
+        const auto col = static_cast<ansi::basic_color_t>(i % 8);
+        const auto f = (i % 3 == 0) ? ansi::font_t::bold : (i % 3 == 1) ? ansi::font_t::italic : ansi::font_t::none;
+        result << ansi::set_style(ansi::font_style_t{ col, {}, f })(std::cref(c.style_heavy[i])) << " ";
+        if (i % 16 == 15)
+        {
+            result << ansi::new_line;
+        }
+    }
+    return result;
+}
+
+// Op-level builders shared by stream_t and compact_stream_t, so that both containers are filled with the same ops.
+template <class Stream>
+Stream flat_long_log(const corpus_t& c, Stream result = {})
+{
+    static const ansi::style_delta_t dim = ansi::font(ansi::font_t::dim);
+    for (const log_entry_t& e : c.long_log)
+    {
+        result << ansi::modify_style(dim) << ansi::text_ref(e.timestamp) << ansi::pop_style << ansi::text_ref(" [")
+               << ansi::push_style(level_style(e.level)) << ansi::text_ref(e.level) << ansi::pop_style
+               << ansi::text_ref("] ") << ansi::text_ref(e.message) << ansi::new_line;
+    }
+    return result;
+}
+
+template <class Stream>
+Stream flat_style_heavy(const corpus_t& c, Stream result = {})
+{
+    for (std::size_t i = 0; i < c.style_heavy.size(); ++i)
+    {
+        const auto col = static_cast<ansi::basic_color_t>(i % 8);
+        const auto f = (i % 3 == 0) ? ansi::font_t::bold : (i % 3 == 1) ? ansi::font_t::italic : ansi::font_t::none;
+        result << ansi::push_style(ansi::font_style_t{ col, {}, f }) << ansi::text_ref(c.style_heavy[i])
+               << ansi::pop_style << ansi::text_ref(" ");
+        if (i % 16 == 15)
+        {
+            result << ansi::new_line;
+        }
+    }
+    return result;
+}
+
+ansi::stream_t truecolor_cells(const corpus_t& c)
+{
+    ansi::stream_t result;
+    for (std::size_t i = 0; i < c.style_heavy.size(); ++i)
+    {
+        const ansi::rgb_color_t col{ static_cast<std::uint8_t>(i * 7),
+                                     static_cast<std::uint8_t>(i * 13),
+                                     static_cast<std::uint8_t>(i * 29) };
+        result << ansi::modify_style(ansi::fg(col)) << ansi::text_ref(c.style_heavy[i]) << ansi::pop_style
+               << ansi::text_ref(" ");
+        if (i % 16 == 15)
+        {
+            result << ansi::new_line;
+        }
+    }
+    return result;
+}
+
+// A constant help screen, built by the same function at run time and at compile time.
+constexpr auto help_screen()
+{
+    constexpr ansi::style_delta_t title = ansi::bold | ansi::cyan;
+    constexpr ansi::style_delta_t option = ansi::green;
+    constexpr ansi::style_delta_t section = ansi::bold;
+    return ansi::make_sequence(
+        ansi::line(ansi::change_style(title)("ferrugo-bench"), " 1.0.0 - renders documents and reports timings"),
+        ansi::line(),
+        ansi::line(ansi::change_style(section)("USAGE")),
+        ansi::indented(ansi::line("ferrugo-bench [options] [filter]")),
+        ansi::line(),
+        ansi::line(ansi::change_style(section)("OPTIONS")),
+        ansi::indented(
+            ansi::line(ansi::change_style(option)("--min-time=<ms>"), "   minimum time per case"),
+            ansi::line(ansi::change_style(option)("--format=<fmt>"), "    table, csv or json"),
+            ansi::line(ansi::change_style(option)("--output=<path>"), "   write results to a file"),
+            ansi::line(ansi::change_style(option)("--list"), "            list the cases and exit"),
+            ansi::line(ansi::change_style(option)("--help"), "            show this screen")),
+        ansi::line(),
+        ansi::line(ansi::change_style(section)("FILTER")),
+        ansi::indented(
+            ansi::line("A regular expression matched against \"engine/document\"."),
+            ansi::line("Cases of all engines run when it is omitted.")),
+        ansi::line(),
+        ansi::line(ansi::change_style(ansi::font(ansi::font_t::dim))("Report issues at the project tracker.")));
+}
+
+// long_log with a terminal escape sequence in every fourth message, as an untrusted field could carry.
+ansi::stream_t hostile_log(const corpus_t& c)
+{
+    ansi::stream_t result;
+    for (std::size_t i = 0; i < c.long_log.size(); ++i)
+    {
+        const log_entry_t& e = c.long_log[i];
+        result << ansi::text_ref(e.timestamp) << ansi::text_ref(" ")
+               << (i % 4 == 0 ? ansi::text(e.message + "\033]0;owned\a\033[2J") : ansi::text(e.message))
+               << ansi::new_line;
+    }
+    return result;
+}
+
+std::vector<std::string_view> split_lines(std::string_view text)
+{
+    std::vector<std::string_view> result;
+    while (!text.empty())
+    {
+        const std::size_t end = std::min(text.find('\n'), text.size());
+        result.push_back(text.substr(0, end));
+        text.remove_prefix(std::min(end + 1, text.size()));
+    }
+    return result;
+}
+
+ansi::stream_t large_text_lines(const corpus_t& c)
+{
+    ansi::stream_t result;
+    for (const std::string_view line : split_lines(c.large_text))
+    {
+        result << ansi::text_ref(line) << ansi::new_line;
+    }
+    return result;
+}
+
+}  // namespace
+
+void register_cases(std::vector<case_t>& cases)
+{
+    const auto add = [&](std::string document, ansi::stream_t (*build)())
+    {
+        cases.push_back({ "ansi3", document, [=](std::ostream& os) { ansi::render(os)(build()); } });
+        cases.push_back({ "ansi3-opt", document, [=](std::ostream& os) { ansi::render(os).auto_optimize()(build()); } });
+    };
+    add("nested_map", []() { return nested_map(corpus()); });
+    add("long_log", []() { return long_log(corpus()); });
+    add("deep_list", []() { return deep_list(corpus().deep_list_depth); });
+    add("deep_list_100", []() { return deep_list(2 * corpus().deep_list_depth); });
+    add("deep_list_200", []() { return deep_list(4 * corpus().deep_list_depth); });
+    add("style_heavy", []() { return style_heavy(corpus()); });
+    add("help_screen", []() { return ansi::stream_t{}(help_screen()); });
+
+    cases.push_back({ "ansi3-static",
+                      "help_screen",
+                      [](std::ostream& os)
+                      {
+                          static constexpr auto document = ansi::static_document([] { return help_screen(); });
+                          os << document;
+                      } });
+
+    const auto add_flat = [&](std::string document, auto build)
+    { cases.push_back({ "ansi3-flat", document, [=](std::ostream& os) { ansi::render(os)(build()); } }); };
+    const auto add_compact = [&](std::string document, auto build)
+    { cases.push_back({ "ansi3-compact", document, [=](std::ostream& os) { ansi::render(os)(build()); } }); };
+    add_flat("long_log", []() { return flat_long_log<ansi::stream_t>(corpus()); });
+    add_flat("style_heavy", []() { return flat_style_heavy<ansi::stream_t>(corpus()); });
+    add_compact("long_log", []() { return flat_long_log<ansi::compact_stream_t>(corpus()); });
+    add_compact("style_heavy", []() { return flat_style_heavy<ansi::compact_stream_t>(corpus()); });
+
+    // Renders into a reused string or a fixed buffer, then hands the bytes to the stream in one write.
+    const auto add_sink = [&](std::string document, auto build)
+    {
+        cases.push_back({ "ansi3-string",
+                          document,
+                          [=](std::ostream& os)
+                          {
+                              static std::string out;
+                              out.clear();
+                              ansi::render(out)(build());
+                              os.write(out.data(), static_cast<std::streamsize>(out.size()));
+                          } });
+        cases.push_back({ "ansi3-buffer",
+                          document,
+                          [=](std::ostream& os)
+                          {
+                              static std::vector<char> buffer(1 << 20);
+                              ansi::buffer_sink_t out{ buffer.data(), buffer.size() };
+                              ansi::render(out)(build());
+                              os.write(out.view().data(), static_cast<std::streamsize>(out.size()));
+                          } });
+    };
+    add_sink("long_log", []() { return flat_long_log<ansi::stream_t>(corpus()); });
+    add_sink("style_heavy", []() { return flat_style_heavy<ansi::stream_t>(corpus()); });
+
+    // Writes to /dev/null through a file descriptor or an std::ofstream; the byte counts are not observed.
+    const auto add_file = [&](std::string document, auto build)
+    {
+        cases.push_back({ "ansi3-fd",
+                          document,
+                          [=](std::ostream&)
+                          {
+                              static const int fd = ::open("/dev/null", O_WRONLY);
+                              static ansi::fd_sink_t out{ fd };
+                              ansi::render(out)(build());
+                          } });
+        cases.push_back({ "ansi3-ofstream",
+                          document,
+                          [=](std::ostream&)
+                          {
+                              static std::ofstream out{ "/dev/null" };
+                              ansi::render(out)(build());
+                              out.flush();
+                          } });
+    };
+    add_file("long_log", []() { return flat_long_log<ansi::stream_t>(corpus()); });
+    add_file("large_text", []() { return ansi::stream_t{}(ansi::text_ref(corpus().large_text)); });
+
+    // The same, with control characters in text escaped. large_text has none, so it is still written without copying.
+    const auto add_sanitized = [&](std::string document, ansi::stream_t stream)
+    {
+        const auto shared = std::make_shared<const ansi::stream_t>(std::move(stream));
+        cases.push_back({ "ansi3-fd",
+                          document,
+                          [=](std::ostream&)
+                          {
+                              static const int fd = ::open("/dev/null", O_WRONLY);
+                              static ansi::fd_sink_t out{ fd };
+                              ansi::render(out)(*shared);
+                          } });
+        cases.push_back({ "ansi3-sanitize",
+                          document,
+                          [=](std::ostream&)
+                          {
+                              static const int fd = ::open("/dev/null", O_WRONLY);
+                              static ansi::fd_sink_t out{ fd };
+                              ansi::render(out).sanitize()(*shared);
+                          } });
+    };
+    add_sanitized("large_text_doc", ansi::stream_t{}(ansi::text_ref(corpus().large_text)));
+    add_sanitized("long_log_doc", flat_long_log<ansi::stream_t>(corpus()));
+    add_sanitized("hostile_log", hostile_log(corpus()));
+
+    // Renders each document into a freshly truncated file.
+    const auto add_file_output = [&](std::string document, auto build)
+    {
+        static const std::string path = (std::filesystem::temp_directory_path() / "ferrugo-ansi-bench.out").string();
+        cases.push_back({ "ansi3-mmap",
+                          document,
+                          [=](std::ostream&)
+                          {
+                              ansi::mmap_sink_t out{ path };
+                              ansi::render(out)(build());
+                          } });
+        cases.push_back({ "ansi3-ofstream",
+                          document,
+                          [=](std::ostream&)
+                          {
+                              std::ofstream out{ path, std::ios::binary | std::ios::trunc };
+                              ansi::render(out)(build());
+                          } });
+    };
+    add_file_output("long_log_file", []() { return flat_long_log<ansi::stream_t>(corpus()); });
+    add_file_output("large_file", []() { return ansi::stream_t{}(ansi::text_ref(corpus().large_text)); });
+
+    // Serializes each document to a file once and renders the mapped file.
+    const auto add_mapped = [&](std::string document, auto build)
+    {
+        const std::string path
+            = (std::filesystem::temp_directory_path() / ("ferrugo-ansi-bench-" + document + ".fans")).string();
+        {
+            std::ofstream file{ path, std::ios::binary | std::ios::trunc };
+            ansi::serialize(build(), file);
+        }
+        const auto stream = std::make_shared<ansi::mapped_stream_t>(path);
+        cases.push_back({ "ansi3-mapped", document, [=](std::ostream& os) { ansi::render(os)(*stream); } });
+    };
+    add_mapped("long_log", []() { return flat_long_log<ansi::stream_t>(corpus()); });
+    add_mapped("style_heavy", []() { return flat_style_heavy<ansi::stream_t>(corpus()); });
+
+    const auto add_html = [&](std::string document, auto build)
+    { cases.push_back({ "ansi3-html", document, [=](std::ostream& os) { ansi::render_html(os)(build()); } }); };
+    add_html("long_log", []() { return flat_long_log<ansi::stream_t>(corpus()); });
+    add_html("style_heavy", []() { return flat_style_heavy<ansi::stream_t>(corpus()); });
+
+    // Renders prebuilt documents without styles. The raw case writes the lines of large_text with the same calls,
+    // without going through a stream.
+    const auto add_plain = [&](std::string document, ansi::stream_t stream)
+    {
+        const auto shared = std::make_shared<const ansi::stream_t>(std::move(stream));
+        cases.push_back({ "ansi3-plain", document, [=](std::ostream& os) { ansi::render.plain(os)(*shared); } });
+    };
+    add_plain("long_log", flat_long_log<ansi::stream_t>(corpus()));
+    add_plain("large_text", large_text_lines(corpus()));
+    cases.push_back({ "raw",
+                      "large_text",
+                      [](std::ostream& os)
+                      {
+                          static const std::vector<std::string_view> lines = split_lines(corpus().large_text);
+                          for (const std::string_view line : lines)
+                          {
+                              os.write(line.data(), static_cast<std::streamsize>(line.size()));
+                              os.write("\n", 1);
+                          }
+                      } });
+
+    // Renders 24-bit colors as is and downgraded, each depth with its own shared transition cache.
+    const auto add_depth = [&](std::string engine, ansi::color_depth_t depth)
+    {
+        const auto cache = std::make_shared<ansi::render_fn::style_transition_cache_t>(256, depth);
+        cases.push_back(
+            { engine, "truecolor", [=](std::ostream& os) { ansi::render(os, *cache)(truecolor_cells(corpus())); } });
+    };
+    add_depth("ansi3", ansi::color_depth_t::truecolor);
+    add_depth("ansi3-256", ansi::color_depth_t::palette);
+    add_depth("ansi3-16", ansi::color_depth_t::basic);
+
+    // Renders each document for a truecolor terminal, a 256-color pane and a plain log, either with one pass per
+    // output or with a single pass filling all three; the three outputs are then written one after another.
+    const auto add_multi = [&](std::string document, auto build)
+    {
+        struct outputs_t
+        {
+            std::string truecolor;
+            std::string palette;
+            std::string plain;
+            ansi::render_fn::style_transition_cache_t truecolor_cache{ 256, ansi::color_depth_t::truecolor };
+            ansi::render_fn::style_transition_cache_t palette_cache{ 256, ansi::color_depth_t::palette };
+
+            void write(std::ostream& os)
+            {
+                for (std::string* out : { &truecolor, &palette, &plain })
+                {
+                    os.write(out->data(), static_cast<std::streamsize>(out->size()));
+                    out->clear();
+                }
+            }
+        };
+        const auto shared = std::make_shared<const ansi::stream_t>(build());
+        cases.push_back({ "ansi3-separate",
+                          document,
+                          [=](std::ostream& os)
+                          {
+                              static outputs_t out;
+                              ansi::render(out.truecolor, out.truecolor_cache)(*shared);
+                              ansi::render(out.palette, out.palette_cache)(*shared);
+                              ansi::render.plain(out.plain)(*shared);
+                              out.write(os);
+                          } });
+        cases.push_back({ "ansi3-multi",
+                          document,
+                          [=](std::ostream& os)
+                          {
+                              static outputs_t out;
+                              ansi::render.all(
+                                  ansi::render(out.truecolor, out.truecolor_cache),
+                                  ansi::render(out.palette, out.palette_cache),
+                                  ansi::render.plain(out.plain))(*shared);
+                              out.write(os);
+                          } });
+    };
+    add_multi("long_log", []() { return flat_long_log<ansi::stream_t>(corpus()); });
+    add_multi("style_heavy", []() { return flat_style_heavy<ansi::stream_t>(corpus()); });
+    add_multi("truecolor", []() { return truecolor_cells(corpus()); });
+
+    // Renders long_log one entry at a time, either building and rendering a stream per line or filling the holes of a
+    // line template compiled once; the level is styled per value.
+    cases.push_back({ "ansi3-lines",
+                      "long_log",
+                      [](std::ostream& os)
+                      {
+                          static const ansi::style_delta_t dim = ansi::font(ansi::font_t::dim);
+                          static ansi::render_fn::style_transition_cache_t cache;
+                          static std::string out;
+                          out.clear();
+                          for (const log_entry_t& e : corpus().long_log)
+                          {
+                              ansi::render(out, cache)(ansi::stream_t{}(
+                                  ansi::modify_style(dim),
+                                  ansi::text_ref(e.timestamp),
+                                  ansi::pop_style,
+                                  ansi::text_ref(" ["),
+                                  ansi::push_style(level_style(e.level)),
+                                  ansi::text_ref(e.level),
+                                  ansi::pop_style,
+                                  ansi::text_ref("] "),
+                                  ansi::text_ref(e.message),
+                                  ansi::new_line));
+                          }
+                          os.write(out.data(), static_cast<std::streamsize>(out.size()));
+                      } });
+    cases.push_back({ "ansi3-plan",
+                      "long_log",
+                      [](std::ostream& os)
+                      {
+                          static const ansi::render_plan_t plan{ ansi::stream_t{}(ansi::line(
+                              ansi::change_style(ansi::font(ansi::font_t::dim))(ansi::placeholder(0)),
+                              " [",
+                              ansi::placeholder(1),
+                              "] ",
+                              ansi::placeholder(2))) };
+                          static std::string out;
+                          out.clear();
+                          for (const log_entry_t& e : corpus().long_log)
+                          {
+                              const ansi::style_delta_t level = e.level == "error"  ? ansi::red | ansi::bold
+                                                                : e.level == "warn" ? ansi::yellow
+                                                                                    : ansi::green;
+                              plan(out, { e.timestamp, { e.level, level }, e.message });
+                          }
+                          os.write(out.data(), static_cast<std::streamsize>(out.size()));
+                      } });
+
+    // Rebuilds each document in a reused arena, rendering with a shared transition cache.
+    const auto add_arena = [&](std::string document, auto build)
+    {
+        cases.push_back({ "ansi3-arena",
+                          document,
+                          [=](std::ostream& os)
+                          {
+                              static ansi::frame_arena_t arena;
+                              static ansi::render_fn::style_transition_cache_t cache;
+                              arena.reset();
+                              ansi::render(os, cache)(build(ansi::stream_t{ arena.allocator() }));
+                          } });
+    };
+    add_arena("long_log", [](ansi::stream_t s) { return flat_long_log(corpus(), std::move(s)); });
+    add_arena("style_heavy", [](ansi::stream_t s) { return flat_style_heavy(corpus(), std::move(s)); });
+}
+
+}  // namespace bench
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+namespace bench
+{
+
+inline std::atomic<std::size_t> allocation_count{ 0 };
+inline std::atomic<std::size_t> allocated_bytes{ 0 };
+
+struct log_entry_t
+{
+    std::string level;
+    std::string timestamp;
+    std::string message;
+};
+
+struct corpus_t
+{
+    std::map<std::string, std::map<std::string, std::string>> nested_map;
+    std::vector<log_entry_t> long_log;
+    std::size_t deep_list_depth;
+    std::vector<std::string> style_heavy;
+    std::string large_text;
+};
+
+inline const corpus_t& corpus()
+{
+    static const corpus_t result = []()
+    {
+        corpus_t c;
+        for (int i = 0; i < 50; ++i)
+        {
+            auto& inner = c.nested_map["section_" + std::to_string(i)];
+            for (int j = 0; j < 10; ++j)
+            {
+                inner["key_" + std::to_string(j)] = "value " + std::to_string(i * 10 + j);
+            }
+        }
+        static const char* levels[] = { "info", "warn", "error", "debug" };
+        for (int i = 0; i < 2000; ++i)
+        {
+            c.long_log.push_back(log_entry_t{ levels[i % 4],
+                                              "2024-01-01T00:00:" + std::to_string(10 + i % 50),
+                                              "request " + std::to_string(i) + " handled by worker "
+                                                  + std::to_string(i % 16) + " in " + std::to_string(i % 997) + "ms" });
+        }
+        c.deep_list_depth = 50;
+        for (int i = 0; i < 2000; ++i)
+        {
+            c.style_heavy.push_back("token" + std::to_string(i));
+        }
+        while (c.large_text.size() < (4u << 20))
+        {
+            for (const log_entry_t& e : c.long_log)
+            {
+                c.large_text += e.timestamp + " " + e.message + "\n";
+            }
+        }
+        return c;
+    }();
+    return result;
+}
+
+// Counts bytes and escape sequences written, without storing them.
+struct counting_streambuf_t : public std::streambuf
+{
+    std::size_t m_bytes = 0;
+    std::size_t m_escapes = 0;
+
+protected:
+    int_type overflow(int_type ch) override
+    {
+        if (!traits_type::eq_int_type(ch, traits_type::eof()))
+        {
+            count(traits_type::to_char_type(ch));
+        }
+        return traits_type::not_eof(ch);
+    }
+
+    std::streamsize xsputn(const char_type* s, std::streamsize n) override
+    {
+        for (std::streamsize i = 0; i < n; ++i)
+        {
+            count(s[i]);
+        }
+        return n;
+    }
+
+private:
+    void count(char ch)
+    {
+        m_bytes += 1;
+        m_escapes += ch == '\033' ? 1 : 0;
+    }
+};
+
+struct case_t
+{
+    std::string engine;
+    std::string document;
+    std::function<void(std::ostream&)> run;
+};
+
+struct result_t
+{
+    double ns_per_op;
+    std::size_t bytes;
+    std::size_t escapes;
+    double allocations_per_op;
+    double allocated_bytes_per_op;
+};
+
+inline result_t measure(const case_t& c, std::chrono::nanoseconds min_time)
+{
+    using clock_t = std::chrono::steady_clock;
+
+    counting_streambuf_t probe;
+    {
+        std::ostream os{ &probe };
+        c.run(os);
+    }
+
+    counting_streambuf_t sink;
+    std::ostream os{ &sink };
+    std::size_t iterations = 0;
+    std::size_t allocations = 0;
+    std::size_t bytes = 0;
+    clock_t::duration elapsed{};
+    for (std::size_t batch = 1; elapsed < min_time; batch *= 2)
+    {
+        const std::size_t allocations_before = allocation_count.load(std::memory_order_relaxed);
+        const std::size_t bytes_before = allocated_bytes.load(std::memory_order_relaxed);
+        const auto start = clock_t::now();
+        for (std::size_t i = 0; i < batch; ++i)
+        {
+            c.run(os);
+        }
+        elapsed += clock_t::now() - start;
+        allocations += allocation_count.load(std::memory_order_relaxed) - allocations_before;
+        bytes += allocated_bytes.load(std::memory_order_relaxed) - bytes_before;
+        iterations += batch;
+    }
+
+    return result_t{ std::chrono::duration<double, std::nano>(elapsed).count() / iterations,
+                     probe.m_bytes,
+                     probe.m_escapes,
+                     static_cast<double>(allocations) / iterations,
+                     static_cast<double>(bytes) / iterations };
+}
+
+// Adds the cases of the engine the executable is built for. Each engine's *.bench.cpp is linked into an executable of
+// its own, see bench/CMakeLists.txt.
+void register_cases(std::vector<case_t>& cases);
+
+}  // namespace bench
@@ -0,0 +1,101 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string_view>
+
+#include "bench.hpp"
+
+void* operator new(std::size_t size)
+{
+    bench::allocation_count.fetch_add(1, std::memory_order_relaxed);
+    bench::allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size != 0 ? size : 1))
+    {
+        return ptr;
+    }
+    throw std::bad_alloc{};
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+// std::pmr::new_delete_resource allocates through the aligned forms.
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+    bench::allocation_count.fetch_add(1, std::memory_order_relaxed);
+    bench::allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    const std::size_t align = static_cast<std::size_t>(alignment);
+    if (void* ptr = std::aligned_alloc(align, (size + align - 1) / align * align))
+    {
+        return ptr;
+    }
+    throw std::bad_alloc{};
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept
+{
+    std::free(ptr);
+}
+
+int main(int argc, char** argv)
+{
+    std::string_view filter = "";
+    std::chrono::milliseconds min_time{ 200 };
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string_view arg = argv[i];
+        if (arg.substr(0, 11) == "--min-time=")
+        {
+            min_time = std::chrono::milliseconds{ std::atoi(arg.substr(11).data()) };
+        }
+        else
+        {
+            filter = arg;
+        }
+    }
+
+    std::vector<bench::case_t> cases;
+    bench::register_cases(cases);
+
+    std::printf(
+        "%-14s %-14s %14s %12s %10s %12s %14s\n",
+        "engine",
+        "document",
+        "ns/op",
+        "bytes",
+        "escapes",
+        "allocs/doc",
+        "alloc B/doc");
+    for (const bench::case_t& c : cases)
+    {
+        const std::string name = c.engine + "/" + c.document;
+        if (name.find(filter) == std::string::npos)
+        {
+            continue;
+        }
+        const bench::result_t r = bench::measure(c, min_time);
+        std::printf(
+            "%-14s %-14s %14.0f %12zu %10zu %12.1f %14.0f\n",
+            c.engine.c_str(),
+            c.document.c_str(),
+            r.ns_per_op,
+            r.bytes,
+            r.escapes,
+            r.allocations_per_op,
+            r.allocated_bytes_per_op);
+    }
+    return 0;
+}
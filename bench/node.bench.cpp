@@ -0,0 +1,98 @@
+#include "node.hpp"
+
+#include "bench.hpp"
+
+namespace bench
+{
+
+namespace
+{
+
+std::string level_style(const std::string& level)
+{
+    if (level == "error")
+    {
+        return "red+bold";
+    }
+    if (level == "warn")
+    {
+        return "yellow";
+    }
+    return "green";
+}
+
+node_t nested_map(const corpus_t& c)
+{
+    std::vector<node_t> items;
+    for (const auto& [k, inner] : c.nested_map)
+    {
+        std::vector<node_t> inner_items;
+        for (const auto& [ik, iv] : inner)
+        {
+            inner_items.push_back(line(styled("blue")(ik), ": ", styled("bright_white")(iv)));
+        }
+        items.push_back(block(line(styled("blue")(k), ": {"), indented(std::move(inner_items)), line("}")));
+    }
+    return block(line("{"), indented(std::move(items)), line("}"));
+}
+
+node_t long_log(const corpus_t& c)
+{
+    std::vector<node_t> items;
+    for (const log_entry_t& e : c.long_log)
+    {
+        items.push_back(line(styled("dim")(e.timestamp), " [", styled(level_style(e.level))(e.level), "] ", e.message));
+    }
+    return block(std::move(items));
+}
+
+node_t deep_list(std::size_t depth, std::size_t level = 0)
+{
+    if (level == depth)
+    {
+        return block(std::vector<node_t>{});
+    }
+    return list(list_item(line("item"), indented(deep_list(depth, level + 1))), list_item(line("tail")));
+}
+
+node_t style_heavy(const corpus_t& c)
+{
+    static const char* colors[] = { "black", "red", "green", "yellow", "blue", "magenta", "cyan", "white" };
+    std::vector<node_t> items;
+    for (std::size_t i = 0; i < c.style_heavy.size(); ++i)
+    {
+        std::string style = colors[i % 8];
+        style += (i % 3 == 0) ? "+bold" : (i % 3 == 1) ? "+italic" : "";
+        items.push_back(styled(style)(c.style_heavy[i]));
+        items.push_back(make_node<text_ref_node_t>(" "));
+        if (i % 16 == 15)
+        {
+            items.push_back(line(std::vector<node_t>{}));
+        }
+    }
+    return block(std::move(items));
+}
+
+node_t large_text(const corpus_t& c)
+{
+    return indented(make_node<text_ref_node_t>(c.large_text));
+}
+
+template <class Func>
+auto with_node(Func func) -> std::function<void(std::ostream&)>
+{
+    return [=](std::ostream& os) { os << func(); };
+}
+
+}  // namespace
+
+void register_cases(std::vector<case_t>& cases)
+{
+    cases.push_back({ "node", "nested_map", with_node([]() { return nested_map(corpus()); }) });
+    cases.push_back({ "node", "long_log", with_node([]() { return long_log(corpus()); }) });
+    cases.push_back({ "node", "deep_list", with_node([]() { return deep_list(corpus().deep_list_depth); }) });
+    cases.push_back({ "node", "style_heavy", with_node([]() { return style_heavy(corpus()); }) });
+    cases.push_back({ "node", "large_text", with_node([]() { return large_text(corpus()); }) });
+}
+
+}  // namespace bench
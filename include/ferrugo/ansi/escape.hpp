@@ -1,5 +1,8 @@
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
+#include <ferrugo/sgr_encoder.hpp>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
@@ -18,6 +21,21 @@ struct args_t : public std::vector<int>
     friend std::ostream& operator<<(std::ostream& os, const args_t& item)
     {
 #if 1
+        // Written in one piece when every parameter fits the encoder's digit table and buffer.
+        const bool encodable = 2 + 4 * item.size() <= ferrugo::sgr::encoder_t::capacity
+                               && std::all_of(item.begin(), item.end(), [](int v) { return 0 <= v && v <= 255; });
+        if (encodable)
+        {
+            ferrugo::sgr::encoder_t encoder;
+            encoder.begin();
+            for (const int v : item)
+            {
+                encoder.arg(static_cast<std::uint8_t>(v));
+            }
+            encoder.end();
+            os.write(encoder.data(), static_cast<std::streamsize>(encoder.size()));
+            return os;
+        }
         os << "\033[";
         for (std::size_t i = 0; i < item.size(); ++i)
         {
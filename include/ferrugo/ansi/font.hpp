@@ -17,77 +17,77 @@ struct font_t
 
     underlying_type m_value;
 
-    font_t() : font_t{ 0 }
+    constexpr font_t() : font_t{ 0 }
     {
     }
 
-    explicit font_t(underlying_type value) : m_value(value)
+    constexpr explicit font_t(underlying_type value) : m_value(value)
     {
     }
 
-    friend bool operator==(const font_t lhs, const font_t rhs)
+    constexpr friend bool operator==(const font_t lhs, const font_t rhs)
     {
         return lhs.m_value == rhs.m_value;
     }
 
-    friend bool operator<(const font_t lhs, const font_t rhs)
+    constexpr friend bool operator<(const font_t lhs, const font_t rhs)
     {
         return lhs.m_value < rhs.m_value;
     }
 
-    friend bool operator!=(const font_t lhs, const font_t rhs)
+    constexpr friend bool operator!=(const font_t lhs, const font_t rhs)
     {
         return !(lhs == rhs);
     }
 
-    friend bool operator>(const font_t lhs, const font_t rhs)
+    constexpr friend bool operator>(const font_t lhs, const font_t rhs)
     {
         return rhs < lhs;
     }
 
-    friend bool operator<=(const font_t lhs, const font_t rhs)
+    constexpr friend bool operator<=(const font_t lhs, const font_t rhs)
     {
         return !(lhs > rhs);
     }
 
-    friend bool operator>=(const font_t lhs, const font_t rhs)
+    constexpr friend bool operator>=(const font_t lhs, const font_t rhs)
     {
         return !(lhs < rhs);
     }
 
-    friend font_t operator~(const font_t item)
+    constexpr friend font_t operator~(const font_t item)
     {
         return font_t(~item.m_value);
     }
 
-    friend font_t operator&(const font_t lhs, const font_t rhs)
+    constexpr friend font_t operator&(const font_t lhs, const font_t rhs)
     {
         return font_t(lhs.m_value & rhs.m_value);
     }
 
-    friend font_t& operator&=(font_t& lhs, const font_t rhs)
+    constexpr friend font_t& operator&=(font_t& lhs, const font_t rhs)
     {
         lhs.m_value &= rhs.m_value;
         return lhs;
     }
 
-    friend font_t operator|(const font_t lhs, const font_t rhs)
+    constexpr friend font_t operator|(const font_t lhs, const font_t rhs)
     {
         return font_t(lhs.m_value | rhs.m_value);
     }
 
-    friend font_t& operator|=(font_t& lhs, const font_t rhs)
+    constexpr friend font_t& operator|=(font_t& lhs, const font_t rhs)
     {
         lhs.m_value |= rhs.m_value;
         return lhs;
     }
 
-    friend font_t operator^(const font_t lhs, const font_t rhs)
+    constexpr friend font_t operator^(const font_t lhs, const font_t rhs)
     {
         return font_t(lhs.m_value ^ rhs.m_value);
     }
 
-    explicit operator bool() const
+    constexpr explicit operator bool() const
     {
         return static_cast<bool>(m_value);
     }
@@ -104,17 +104,17 @@ struct font_t
     static const font_t crossed_out;
     static const font_t double_underline;
 
-    bool contains(font_t v) const
+    constexpr bool contains(font_t v) const
     {
         return static_cast<bool>(*this & v);
     }
 
-    font_t& unset(const font_t v)
+    constexpr font_t& unset(const font_t v)
     {
         return *this = *this & ~v;
     }
 
-    font_t& set(const font_t v)
+    constexpr font_t& set(const font_t v)
     {
         return *this = *this | v;
     }
@@ -171,17 +171,17 @@ struct font_t
     }
 };
 
-inline const font_t font_t::none{ 0 };
-inline const font_t font_t::standout{ 1 << 0 };
-inline const font_t font_t::bold{ 1 << 1 };
-inline const font_t font_t::dim{ 1 << 2 };
-inline const font_t font_t::italic{ 1 << 3 };
-inline const font_t font_t::underline{ 1 << 4 };
-inline const font_t font_t::blink{ 1 << 5 };
-inline const font_t font_t::inverse{ 1 << 6 };
-inline const font_t font_t::hidden{ 1 << 7 };
-inline const font_t font_t::crossed_out{ 1 << 8 };
-inline const font_t font_t::double_underline{ 1 << 9 };
+inline constexpr font_t font_t::none{ 0 };
+inline constexpr font_t font_t::standout{ 1 << 0 };
+inline constexpr font_t font_t::bold{ 1 << 1 };
+inline constexpr font_t font_t::dim{ 1 << 2 };
+inline constexpr font_t font_t::italic{ 1 << 3 };
+inline constexpr font_t font_t::underline{ 1 << 4 };
+inline constexpr font_t font_t::blink{ 1 << 5 };
+inline constexpr font_t font_t::inverse{ 1 << 6 };
+inline constexpr font_t font_t::hidden{ 1 << 7 };
+inline constexpr font_t font_t::crossed_out{ 1 << 8 };
+inline constexpr font_t font_t::double_underline{ 1 << 9 };
 
 struct font_diff_t
 {
@@ -108,17 +108,17 @@ struct font_t
     static const font_t crossed_out;
     static const font_t double_underline;
 
-    bool contains(font_t v) const
+    constexpr bool contains(font_t v) const
     {
         return static_cast<bool>(*this & v);
     }
 
-    font_t& unset(const font_t v)
+    constexpr font_t& unset(const font_t v)
     {
         return *this = *this & ~v;
     }
 
-    font_t& set(const font_t v)
+    constexpr font_t& set(const font_t v)
     {
         return *this = *this | v;
     }
@@ -151,16 +151,16 @@ struct font_t
     }
 };
 
-inline const font_t font_t::none{ 0 };
-inline const font_t font_t::standout{ 1 << 0 };
-inline const font_t font_t::bold{ 1 << 1 };
-inline const font_t font_t::dim{ 1 << 2 };
-inline const font_t font_t::italic{ 1 << 3 };
-inline const font_t font_t::underline{ 1 << 4 };
-inline const font_t font_t::blink{ 1 << 5 };
-inline const font_t font_t::inverse{ 1 << 6 };
-inline const font_t font_t::hidden{ 1 << 7 };
-inline const font_t font_t::crossed_out{ 1 << 8 };
-inline const font_t font_t::double_underline{ 1 << 9 };
+inline constexpr font_t font_t::none{ 0 };
+inline constexpr font_t font_t::standout{ 1 << 0 };
+inline constexpr font_t font_t::bold{ 1 << 1 };
+inline constexpr font_t font_t::dim{ 1 << 2 };
+inline constexpr font_t font_t::italic{ 1 << 3 };
+inline constexpr font_t font_t::underline{ 1 << 4 };
+inline constexpr font_t font_t::blink{ 1 << 5 };
+inline constexpr font_t font_t::inverse{ 1 << 6 };
+inline constexpr font_t font_t::hidden{ 1 << 7 };
+inline constexpr font_t font_t::crossed_out{ 1 << 8 };
+inline constexpr font_t font_t::double_underline{ 1 << 9 };
 
 }  // namespace ansi
@@ -1,116 +1,112 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <cuchar>
 #include <ferrugo/ansi2/output.hpp>
+#include <ferrugo/sgr_encoder.hpp>
+#include <ferrugo/write_spaces.hpp>
 #include <ostream>
-#include <set>
+#include <string_view>
+#include <tuple>
 #include <vector>
 
 namespace ansi
 {
 
+using sgr_encoder_t = ferrugo::sgr::encoder_t;
+
 template <int Base>
 struct color_visitor_t
 {
-    auto operator()(default_color_t) const -> std::vector<int>
+    sgr_encoder_t& m_encoder;
+
+    void operator()(default_color_t) const
     {
-        return { Base + 39 };
+        m_encoder.arg(Base + 39);
     }
 
-    auto operator()(standard_color_t col) const -> std::vector<int>
+    void operator()(standard_color_t col) const
     {
-        return { static_cast<int>(col.m_color) + (Base + 30) };
+        m_encoder.arg(static_cast<int>(col.m_color) + (Base + 30));
     }
 
-    auto operator()(bright_color_t col) const -> std::vector<int>
+    void operator()(bright_color_t col) const
     {
-        return { static_cast<int>(col.m_color) + (Base + 90) };
+        m_encoder.arg(static_cast<int>(col.m_color) + (Base + 90));
     }
 
-    auto operator()(palette_color_t col) const -> std::vector<int>
+    void operator()(palette_color_t col) const
     {
-        return { Base + 38, 5, col.m_index };
+        m_encoder.arg(Base + 38).arg(5).arg(col.m_index);
     }
 
-    auto operator()(rgb_color_t col) const -> std::vector<int>
+    void operator()(rgb_color_t col) const
     {
-        return { Base + 38, 2, col[0], col[1], col[2] };
+        m_encoder.arg(Base + 38).arg(2).arg(col[0]).arg(col[1]).arg(col[2]);
     }
 };
 
-inline void write_args(std::ostream& os, const std::vector<int>& args)
+template <int Base>
+void encode_color(sgr_encoder_t& encoder, const color_t& col)
 {
-    os << "\033[";
-    for (std::size_t i = 0; i < args.size(); ++i)
-    {
-        if (i != 0)
-        {
-            os << ";";
-        }
-        os << args[i];
-    }
-    os << "m";
+    encoder.begin();
+    std::visit(color_visitor_t<Base>{ encoder }, col.m_data);
+    encoder.end();
 }
 
 struct font_diff_t
 {
-    std::vector<int> m_args;
-
-    font_diff_t(font_t old_font, font_t new_font)
-    {
-        std::set<font_t> enabled;
-        std::set<font_t> disabled;
-        for (const font_t f : { font_t::standout,
-                                font_t::bold,
-                                font_t::dim,
-                                font_t::italic,
-                                font_t::underline,
-                                font_t::blink,
-                                font_t::inverse,
-                                font_t::hidden,
-                                font_t::crossed_out,
-                                font_t::double_underline })
-        {
-            const auto old_contains = old_font.contains(f);
-            const auto new_contains = new_font.contains(f);
-            if (old_contains && !new_contains)
-            {
-                disabled.insert(f);
-            }
-            if (!old_contains && new_contains)
-            {
-                enabled.insert(f);
-            }
-        }
+    font_t m_enabled;
+    font_t m_disabled;
+
+    font_diff_t(font_t old_font, font_t new_font) : m_enabled{ new_font & ~old_font }, m_disabled{ old_font & ~new_font }
+    {
+    }
 
-        const auto handle = [&](font_t f, int on_set, int on_reset)
+    void encode(sgr_encoder_t& encoder) const
+    {
+        static const std::array<std::tuple<font_t, std::uint8_t, std::uint8_t>, 7> map = { {
+            { font_t::bold, 1, 21 },
+            { font_t::dim, 2, 22 },
+            { font_t::italic, 3, 23 },
+            { font_t::underline, 4, 24 },
+            { font_t::blink, 5, 25 },
+            { font_t::crossed_out, 9, 29 },
+            { font_t::hidden, 8, 28 },
+        } };
+
+        bool empty = true;
+        const auto handle = [&](bool condition, std::uint8_t arg)
         {
-            if (enabled.count(f))
+            if (!condition)
             {
-                m_args.push_back(on_set);
+                return;
             }
-            if (disabled.count(f))
+            if (empty)
             {
-                m_args.push_back(on_reset);
+                encoder.begin();
+                empty = false;
             }
+            encoder.arg(arg);
         };
 
-        handle(font_t::bold, 1, 21);
-        handle(font_t::dim, 2, 22);
-        handle(font_t::italic, 3, 23);
-        handle(font_t::underline, 4, 24);
-        handle(font_t::blink, 5, 25);
-        handle(font_t::crossed_out, 9, 29);
-        handle(font_t::hidden, 8, 28);
+        for (const auto& [f, on_set, on_reset] : map)
+        {
+            handle(m_enabled.contains(f), on_set);
+            handle(m_disabled.contains(f), on_reset);
+        }
+        if (!empty)
+        {
+            encoder.end();
+        }
     }
 
     friend std::ostream& operator<<(std::ostream& os, const font_diff_t& item)
     {
-        if (!item.m_args.empty())
-        {
-            write_args(os, item.m_args);
-        }
-        return os;
+        sgr_encoder_t encoder;
+        item.encode(encoder);
+        return os.write(encoder.data(), encoder.size());
     }
 };
 
@@ -145,14 +141,14 @@ struct ostream_output_t : public output_t::interface
     void new_line() override
     {
         m_new_line_needed = true;
-        m_os << std::endl;
+        m_os.put('\n');
     }
 
     void put(char32_t ch) override
     {
         if (m_new_line_needed)
         {
-            m_os << std::string(m_indents.back(), ' ');
+            write_indent();
             m_new_line_needed = false;
         }
         std::array<char, 4> data;
@@ -162,10 +158,17 @@ struct ostream_output_t : public output_t::interface
         {
             throw std::runtime_error{ "u32_to_mb: error in conversion " + std::to_string(ch) };
         }
-        for (std::size_t i = 0; i < size; ++i)
+        m_os.write(data.data(), size);
+    }
+
+    void write(std::string_view text) override
+    {
+        if (m_new_line_needed)
         {
-            m_os << data[i];
+            write_indent();
+            m_new_line_needed = false;
         }
+        m_os.write(text.data(), static_cast<std::streamsize>(text.size()));
     }
 
     void flush() override
@@ -196,20 +199,27 @@ struct ostream_output_t : public output_t::interface
         change_style(old_style, font_style());
     }
 
+    void write_indent()
+    {
+        ferrugo::write_spaces(m_os, m_indents.back());
+    }
+
     void change_style(const font_style_t& old_style, const font_style_t& new_style)
     {
+        sgr_encoder_t encoder;
         if (old_style.font != new_style.font)
         {
-            m_os << font_diff_t{ old_style.font, new_style.font };
+            font_diff_t{ old_style.font, new_style.font }.encode(encoder);
         }
         if (old_style.foreground != new_style.foreground)
         {
-            write_args(m_os, std::visit(color_visitor_t<0>{}, new_style.foreground.m_data));
+            encode_color<0>(encoder, new_style.foreground);
         }
         if (old_style.background != new_style.background)
         {
-            write_args(m_os, std::visit(color_visitor_t<10>{}, new_style.background.m_data));
+            encode_color<10>(encoder, new_style.background);
         }
+        m_os.write(encoder.data(), encoder.size());
     }
 };
 
@@ -1,10 +1,12 @@
 #pragma once
 
 #include <cstddef>
+#include <cstring>
 #include <ferrugo/ansi2/font_style.hpp>
 #include <functional>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <tuple>
 
 namespace ansi
@@ -33,6 +35,15 @@ struct output_t
         virtual void unindent() = 0;
         virtual void new_line() = 0;
         virtual void put(char32_t ch) = 0;
+
+        // Writes a run of bytes that contains no '\n'.
+        virtual void write(std::string_view text)
+        {
+            for (char ch : text)
+            {
+                put(static_cast<char32_t>(ch));
+            }
+        }
         virtual void flush() = 0;
         virtual font_style_t font_style() const = 0;
         virtual void push_font_style(const font_style_t& style) = 0;
@@ -105,18 +116,22 @@ struct output_t
         return *this;
     }
 
-    output_t& write(const std::string& str)
+    output_t& write(std::string_view str)
     {
-        for (char ch : str)
+        while (!str.empty())
         {
-            if (ch == '\n')
+            const char* end = static_cast<const char*>(std::memchr(str.data(), '\n', str.size()));
+            const std::size_t size = end ? static_cast<std::size_t>(end - str.data()) : str.size();
+            if (size > 0)
             {
-                new_line();
+                m_impl->write(str.substr(0, size));
             }
-            else
+            if (!end)
             {
-                put(static_cast<char32_t>(ch));
+                break;
             }
+            new_line();
+            str.remove_prefix(size + 1);
         }
         return *this;
     }
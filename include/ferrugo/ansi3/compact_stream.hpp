@@ -0,0 +1,362 @@
+#pragma once
+
+#include <ferrugo/ansi3/stream.hpp>
+#include <unordered_map>
+
+namespace ansi
+{
+
+enum class opcode_t : std::uint8_t
+{
+    new_line,
+    indent,
+    unindent,
+    text,
+    push_style,
+    modify_style,
+    apply_style,
+    pop_style,
+    move_cursor,
+    move_cursor_to,
+    clear_screen,
+    clear_line,
+    set_cursor_visibility,
+    placeholder,
+};
+
+// Alternative to stream_t for very large documents. Ops are stored as opcode bytes followed by LEB128 operands,
+// text (including text_ref content) is copied into a single character pool, and styles are stored as indices
+// into a deduplicated table of packed styles. A text op costs one opcode byte, a varint length, and its characters.
+struct compact_stream_t
+{
+    std::vector<std::uint8_t> m_code;
+    std::string m_text;
+    std::vector<packed_font_style_t> m_styles;
+    std::unordered_map<packed_font_style_t, std::uint32_t> m_style_indices;
+    std::vector<op_apply_style_t> m_appliers;
+    std::size_t m_op_count = 0;
+
+    compact_stream_t() = default;
+    compact_stream_t(const compact_stream_t&) = default;
+    compact_stream_t(compact_stream_t&&) noexcept = default;
+    compact_stream_t& operator=(const compact_stream_t&) = default;
+    compact_stream_t& operator=(compact_stream_t&&) noexcept = default;
+
+    std::size_t size() const
+    {
+        return m_op_count;
+    }
+
+    // Bytes reserved by the op, text and style storage.
+    std::size_t capacity_bytes() const
+    {
+        return m_code.capacity() + m_text.capacity() + m_styles.capacity() * sizeof(packed_font_style_t)
+               + m_appliers.capacity() * sizeof(op_apply_style_t);
+    }
+
+    compact_stream_t& operator<<(op_new_line_t)
+    {
+        return put(opcode_t::new_line);
+    }
+
+    compact_stream_t& operator<<(op_indent_t)
+    {
+        return put(opcode_t::indent);
+    }
+
+    compact_stream_t& operator<<(op_unindent_t)
+    {
+        return put(opcode_t::unindent);
+    }
+
+    compact_stream_t& operator<<(const op_text_t& v)
+    {
+        return put_text(v.content);
+    }
+
+    compact_stream_t& operator<<(op_text_ref_t v)
+    {
+        return put_text(v.content);
+    }
+
+    compact_stream_t& operator<<(const op_push_style_t& v)
+    {
+        return *this << op_push_packed_style_t{ packed_font_style_t{ v.style } };
+    }
+
+    compact_stream_t& operator<<(op_push_packed_style_t v)
+    {
+        put(opcode_t::push_style);
+        put_varint(style_index(v.style));
+        return *this;
+    }
+
+    // Colors are stored off by one, so that style_delta_t::no_color is encoded as zero.
+    compact_stream_t& operator<<(op_modify_style_t v)
+    {
+        put(opcode_t::modify_style);
+        put_varint(v.delta.m_set.m_value);
+        put_varint(v.delta.m_clear.m_value);
+        put_varint(static_cast<style_delta_t::color_type>(v.delta.m_foreground + 1));
+        put_varint(static_cast<style_delta_t::color_type>(v.delta.m_background + 1));
+        return *this;
+    }
+
+    compact_stream_t& operator<<(op_apply_style_t v)
+    {
+        put(opcode_t::apply_style);
+        put_varint(m_appliers.size());
+        m_appliers.push_back(std::move(v));
+        return *this;
+    }
+
+    compact_stream_t& operator<<(op_pop_style_t)
+    {
+        return put(opcode_t::pop_style);
+    }
+
+    compact_stream_t& operator<<(op_move_cursor v)
+    {
+        put(opcode_t::move_cursor);
+        put_byte(static_cast<std::uint8_t>(v.direction));
+        put_varint(zigzag(v.value));
+        return *this;
+    }
+
+    compact_stream_t& operator<<(op_move_cursor_to v)
+    {
+        put(opcode_t::move_cursor_to);
+        put_varint(zigzag(v.row));
+        put_varint(zigzag(v.column));
+        return *this;
+    }
+
+    compact_stream_t& operator<<(op_clear_screen v)
+    {
+        put(opcode_t::clear_screen);
+        put_byte(static_cast<std::uint8_t>(v.mode));
+        return *this;
+    }
+
+    compact_stream_t& operator<<(op_clear_line v)
+    {
+        put(opcode_t::clear_line);
+        put_byte(static_cast<std::uint8_t>(v.mode));
+        return *this;
+    }
+
+    compact_stream_t& operator<<(op_set_cursor_visibility v)
+    {
+        put(opcode_t::set_cursor_visibility);
+        put_byte(v.value ? 1 : 0);
+        return *this;
+    }
+
+    compact_stream_t& operator<<(op_placeholder_t v)
+    {
+        put(opcode_t::placeholder);
+        put_varint(v.index);
+        return *this;
+    }
+
+    compact_stream_t& operator<<(const stream_op_t& op)
+    {
+        std::visit([&](const auto& v) { *this << v; }, op);
+        return *this;
+    }
+
+    compact_stream_t& operator<<(const stream_t& other)
+    {
+        other.visit([&](const auto& op) { *this << op; });
+        return *this;
+    }
+
+    // Ops, strings and builder sequences are stored directly; anything else goes through the stream_t formatters,
+    // using a scratch stream that keeps its capacity.
+    template <class T>
+    compact_stream_t& operator<<(T&& item)
+    {
+        using type = remove_cvref_t<T>;
+        if constexpr (
+            std::is_same_v<type, stream_t> || std::is_same_v<type, stream_op_t>
+            || std::is_same_v<type, op_push_packed_style_t> || std::is_constructible_v<stream_op_t, type>)
+        {
+            return *this << static_cast<const type&>(item);
+        }
+        else if constexpr (std::is_convertible_v<const type&, std::string_view>)
+        {
+            return put_text(std::string_view{ item });
+        }
+        else if constexpr (is_sequence<type>::value)
+        {
+            std::forward<T>(item)(*this);
+            return *this;
+        }
+        else
+        {
+            static thread_local stream_t scratch;
+            scratch.clear();
+            scratch << std::forward<T>(item);
+            return *this << static_cast<const stream_t&>(scratch);
+        }
+    }
+
+    template <class... Args>
+    compact_stream_t& operator()(Args&&... args)
+    {
+        (*this << ... << std::forward<Args>(args));
+        return *this;
+    }
+
+    template <class Visitor>
+    void visit(Visitor&& visitor) const
+    {
+        decode(m_code.data(), m_code.data() + m_code.size(), m_text.data(), m_styles, m_appliers, visitor);
+    }
+
+    // Calls the visitor with each op encoded in [ptr, end). Text ops are read from the text pool in order;
+    // styles[i] and appliers[i] look up the indexed style and applier.
+    template <class Styles, class Appliers, class Visitor>
+    static void decode(
+        const std::uint8_t* ptr,
+        const std::uint8_t* const end,
+        const char* text,
+        const Styles& styles,
+        const Appliers& appliers,
+        Visitor&& visitor)
+    {
+        while (ptr != end)
+        {
+            switch (static_cast<opcode_t>(*ptr++))
+            {
+                case opcode_t::new_line: visitor(op_new_line_t{}); break;
+                case opcode_t::indent: visitor(op_indent_t{}); break;
+                case opcode_t::unindent: visitor(op_unindent_t{}); break;
+                case opcode_t::text:
+                {
+                    const std::size_t size = read_varint(ptr);
+                    visitor(op_text_ref_t{ std::string_view{ text, size } });
+                    text += size;
+                    break;
+                }
+                case opcode_t::push_style:
+                    visitor(op_push_packed_style_t{ packed_font_style_t{ styles[read_varint(ptr)] } });
+                    break;
+                case opcode_t::modify_style:
+                {
+                    style_delta_t delta{};
+                    delta.m_set = font_t{ static_cast<font_t::underlying_type>(read_varint(ptr)) };
+                    delta.m_clear = font_t{ static_cast<font_t::underlying_type>(read_varint(ptr)) };
+                    delta.m_foreground = static_cast<style_delta_t::color_type>(read_varint(ptr) - 1);
+                    delta.m_background = static_cast<style_delta_t::color_type>(read_varint(ptr) - 1);
+                    visitor(op_modify_style_t{ delta });
+                    break;
+                }
+                case opcode_t::apply_style: visitor(appliers[read_varint(ptr)]); break;
+                case opcode_t::pop_style: visitor(op_pop_style_t{}); break;
+                case opcode_t::move_cursor:
+                {
+                    const auto direction = static_cast<direction_t>(*ptr++);
+                    visitor(op_move_cursor{ direction, unzigzag(read_varint(ptr)) });
+                    break;
+                }
+                case opcode_t::move_cursor_to:
+                {
+                    const int row = unzigzag(read_varint(ptr));
+                    visitor(op_move_cursor_to{ row, unzigzag(read_varint(ptr)) });
+                    break;
+                }
+                case opcode_t::clear_screen: visitor(op_clear_screen{ static_cast<clear_screen_mode_t>(*ptr++) }); break;
+                case opcode_t::clear_line: visitor(op_clear_line{ static_cast<clear_line_mode_t>(*ptr++) }); break;
+                case opcode_t::set_cursor_visibility: visitor(op_set_cursor_visibility{ *ptr++ != 0 }); break;
+                case opcode_t::placeholder: visitor(op_placeholder_t{ static_cast<std::size_t>(read_varint(ptr)) }); break;
+                default: throw std::runtime_error{ "unknown opcode_t" };
+            }
+        }
+    }
+
+private:
+    template <class T>
+    struct is_sequence : std::false_type
+    {
+    };
+
+    template <class... Items>
+    struct is_sequence<sequence_t<Items...>> : std::true_type
+    {
+    };
+
+    compact_stream_t& put(opcode_t opcode)
+    {
+        m_code.push_back(static_cast<std::uint8_t>(opcode));
+        m_op_count += 1;
+        return *this;
+    }
+
+    compact_stream_t& put_text(std::string_view content)
+    {
+        put(opcode_t::text);
+        put_varint(content.size());
+        m_text.append(content.data(), content.size());
+        return *this;
+    }
+
+    void put_byte(std::uint8_t value)
+    {
+        m_code.push_back(value);
+    }
+
+    void put_varint(std::uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            m_code.push_back(static_cast<std::uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+        m_code.push_back(static_cast<std::uint8_t>(value));
+    }
+
+    static std::uint64_t read_varint(const std::uint8_t*& ptr)
+    {
+        std::uint64_t result = 0;
+        for (int shift = 0;; shift += 7)
+        {
+            const std::uint8_t byte = *ptr++;
+            result |= std::uint64_t(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+            {
+                return result;
+            }
+        }
+    }
+
+    static std::uint64_t zigzag(int value)
+    {
+        return (static_cast<std::uint64_t>(value) << 1) ^ static_cast<std::uint64_t>(value < 0 ? -1 : 0);
+    }
+
+    static int unzigzag(std::uint64_t value)
+    {
+        return static_cast<int>((value >> 1) ^ (~(value & 1) + 1));
+    }
+
+    std::uint32_t style_index(packed_font_style_t style)
+    {
+        if (!m_styles.empty() && m_styles[m_last_style_index] == style)
+        {
+            return m_last_style_index;
+        }
+        auto it = m_style_indices.find(style);
+        if (it == m_style_indices.end())
+        {
+            it = m_style_indices.emplace(style, static_cast<std::uint32_t>(m_styles.size())).first;
+            m_styles.push_back(style);
+        }
+        m_last_style_index = it->second;
+        return it->second;
+    }
+
+    std::uint32_t m_last_style_index = 0;
+};
+
+}  // namespace ansi
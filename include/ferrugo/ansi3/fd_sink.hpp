@@ -0,0 +1,162 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstddef>
+#include <cstring>
+#include <sys/uio.h>
+#include <system_error>
+#include <unistd.h>
+#include <vector>
+
+namespace ansi
+{
+
+// Sink writing to a file descriptor, e.g. a terminal or a pipe:
+//
+//     ansi::fd_sink_t out{ STDOUT_FILENO };
+//     ansi::render(out)(stream);
+//
+// Small fragments (escapes, indentation, short text) are copied into a buffer. Text of at least borrow_threshold
+// bytes passed to append_ref() is referenced in place. Both are gathered into an iovec array and written with one
+// writev() when the buffer or the array is full, and on flush(), which render calls at the end of each stream.
+// The descriptor is not closed.
+struct fd_sink_t
+{
+    static constexpr std::size_t borrow_threshold = 256;
+    static constexpr std::size_t max_iovecs = IOV_MAX < 64 ? IOV_MAX : 64;
+
+    int m_fd;
+    std::vector<char> m_buffer;
+    std::size_t m_size = 0;
+    std::vector<iovec> m_iovecs;
+    std::size_t m_syscalls = 0;
+    std::size_t m_bytes_written = 0;
+
+    explicit fd_sink_t(int fd, std::size_t buffer_size = 64 * 1024)
+        : m_fd{ fd }
+        , m_buffer(std::max<std::size_t>(buffer_size, 1))
+        , m_iovecs{}
+    {
+        m_iovecs.reserve(max_iovecs);
+    }
+
+    fd_sink_t(const fd_sink_t&) = delete;
+    fd_sink_t& operator=(const fd_sink_t&) = delete;
+
+    ~fd_sink_t()
+    {
+        try
+        {
+            flush();
+        }
+        catch (...)
+        {
+        }
+    }
+
+    void append(const char* data, std::size_t size)
+    {
+        while (size > m_buffer.size() - m_size)
+        {
+            const std::size_t chunk = m_buffer.size() - m_size;
+            copy(data, chunk);
+            flush();
+            data += chunk;
+            size -= chunk;
+        }
+        copy(data, size);
+    }
+
+    // Like append, but data must stay valid until the next flush().
+    void append_ref(const char* data, std::size_t size)
+    {
+        if (size < borrow_threshold)
+        {
+            append(data, size);
+            return;
+        }
+        if (m_iovecs.size() == max_iovecs)
+        {
+            flush();
+        }
+        m_iovecs.push_back(iovec{ const_cast<char*>(data), size });
+    }
+
+    void flush()
+    {
+        iovec* iov = m_iovecs.data();
+        std::size_t count = m_iovecs.size();
+        while (count > 0)
+        {
+            const ssize_t written = ::writev(m_fd, iov, static_cast<int>(count));
+            m_syscalls += 1;
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                const int error = errno;
+                m_iovecs.clear();
+                m_size = 0;
+                throw std::system_error{ error, std::generic_category(), "fd_sink_t: writev" };
+            }
+            m_bytes_written += static_cast<std::size_t>(written);
+            // Skip what a partial write has consumed and retry with the rest.
+            std::size_t remaining = static_cast<std::size_t>(written);
+            while (count > 0 && remaining >= iov->iov_len)
+            {
+                remaining -= iov->iov_len;
+                ++iov;
+                --count;
+            }
+            if (count > 0)
+            {
+                iov->iov_base = static_cast<char*>(iov->iov_base) + remaining;
+                iov->iov_len -= remaining;
+            }
+        }
+        m_iovecs.clear();
+        m_size = 0;
+    }
+
+    // Number of writev() calls issued so far.
+    std::size_t syscalls() const
+    {
+        return m_syscalls;
+    }
+
+    std::size_t bytes_written() const
+    {
+        return m_bytes_written;
+    }
+
+private:
+    void copy(const char* data, std::size_t size)
+    {
+        if (size == 0)
+        {
+            return;
+        }
+        char* const dest = m_buffer.data() + m_size;
+        std::memcpy(dest, data, size);
+        m_size += size;
+        if (!m_iovecs.empty() && static_cast<char*>(m_iovecs.back().iov_base) + m_iovecs.back().iov_len == dest)
+        {
+            m_iovecs.back().iov_len += size;
+            return;
+        }
+        if (m_iovecs.size() == max_iovecs)
+        {
+            m_size -= size;
+            flush();
+            copy(data, size);
+            return;
+        }
+        m_iovecs.push_back(iovec{ dest, size });
+    }
+};
+
+}  // namespace ansi
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <ferrugo/ansi3/stream.hpp>
+#include <memory_resource>
+#include <optional>
+
+namespace ansi
+{
+
+// Monotonic arena for building one frame at a time:
+//
+//     arena.reset();
+//     ansi::stream_t frame{ arena.allocator() };
+//
+// reset() releases everything allocated since the previous reset, so all streams using the arena must be destroyed
+// before it is called. Memory that had to be requested from the upstream resource during a frame is added to the
+// initial buffer, so once the arena has seen the largest frame, frames are built without any upstream allocation.
+struct frame_arena_t
+{
+    explicit frame_arena_t(
+        std::size_t initial_size = 64 * 1024, std::pmr::memory_resource* upstream = std::pmr::get_default_resource())
+        : m_upstream{ upstream }
+        , m_size{ initial_size }
+        , m_buffer{ std::make_unique<std::byte[]>(initial_size) }
+        , m_resource{}
+    {
+        m_resource.emplace(m_buffer.get(), m_size, &m_upstream);
+    }
+
+    frame_arena_t(const frame_arena_t&) = delete;
+    frame_arena_t& operator=(const frame_arena_t&) = delete;
+
+    std::pmr::memory_resource* resource()
+    {
+        return &*m_resource;
+    }
+
+    stream_t::allocator_type allocator()
+    {
+        return stream_t::allocator_type{ resource() };
+    }
+
+    // Size of the buffer used before falling back to the upstream resource.
+    std::size_t capacity() const
+    {
+        return m_size;
+    }
+
+    // Bytes requested from the upstream resource since the last reset.
+    std::size_t overflow() const
+    {
+        return m_upstream.m_allocated;
+    }
+
+    void reset()
+    {
+        m_resource.reset();
+        if (m_upstream.m_allocated > 0)
+        {
+            m_size += m_upstream.m_allocated;
+            m_buffer = std::make_unique<std::byte[]>(m_size);
+            m_upstream.m_allocated = 0;
+        }
+        m_resource.emplace(m_buffer.get(), m_size, &m_upstream);
+    }
+
+private:
+    struct upstream_t : public std::pmr::memory_resource
+    {
+        std::pmr::memory_resource* m_inner;
+        std::size_t m_allocated = 0;
+
+        upstream_t(std::pmr::memory_resource* inner) : m_inner{ inner }
+        {
+        }
+
+    protected:
+        void* do_allocate(std::size_t bytes, std::size_t alignment) override
+        {
+            m_allocated += bytes;
+            return m_inner->allocate(bytes, alignment);
+        }
+
+        void do_deallocate(void* ptr, std::size_t bytes, std::size_t alignment) override
+        {
+            m_inner->deallocate(ptr, bytes, alignment);
+        }
+
+        bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+        {
+            return this == &other;
+        }
+    };
+
+    upstream_t m_upstream;
+    std::size_t m_size;
+    std::unique_ptr<std::byte[]> m_buffer;
+    std::optional<std::pmr::monotonic_buffer_resource> m_resource;
+};
+
+}  // namespace ansi
@@ -0,0 +1,406 @@
+#pragma once
+
+#include <ferrugo/ansi3/stream.hpp>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace ansi
+{
+
+// Renders an op stream as an HTML fragment: one <style> element with a CSS class per distinct style, followed by a
+// <pre class="ansi"> element holding the text in <span> runs.
+//
+//     ansi::render_html(os)(stream);
+//
+// The stream is visited twice, first to collect the styles and then to write the text, so memory use depends on
+// the number of distinct styles but not on the size of the document. Indentation and new lines are kept, with the
+// indent guides of render_fn; cursor and clear ops have no HTML equivalent and are skipped. A placeholder renders as
+// empty text, as in render_fn: it writes a pending new line and the indentation.
+struct render_html_fn
+{
+    // Styles in order of first use; the style at index i is written as class "ansi-i".
+    struct class_table_t
+    {
+        std::vector<packed_font_style_t> m_styles;
+        std::unordered_map<packed_font_style_t, std::size_t> m_indices;
+
+        std::size_t insert(const packed_font_style_t style)
+        {
+            auto it = m_indices.find(style);
+            if (it == m_indices.end())
+            {
+                it = m_indices.emplace(style, m_styles.size()).first;
+                m_styles.push_back(style);
+            }
+            return it->second;
+        }
+
+        std::size_t at(const packed_font_style_t style) const
+        {
+            return m_indices.at(style);
+        }
+    };
+
+    template <class Sink>
+    struct context_t
+    {
+        Sink sink;
+        class_table_t classes = {};
+        std::vector<packed_font_style_t> style_stack = { packed_font_style_t{} };
+        int indent_level = 0;
+        bool new_line = false;
+        render_fn::indent_prefix_cache_t* prefixes = nullptr;
+        bool collecting = false;
+        bool span_open = false;
+        packed_font_style_t span_style = {};
+    };
+
+    template <class Sink>
+    struct visitor_t
+    {
+        context_t<Sink>& m_ctx;
+
+        void operator()(op_new_line_t) const
+        {
+            m_ctx.new_line = true;
+        }
+
+        void operator()(op_indent_t) const
+        {
+            m_ctx.indent_level += 1;
+        }
+
+        void operator()(op_unindent_t) const
+        {
+            m_ctx.indent_level = std::max(0, m_ctx.indent_level - 1);
+        }
+
+        void operator()(const op_text_t& v) const
+        {
+            text(v.content);
+        }
+
+        void operator()(const op_text_ref_t& v) const
+        {
+            text(v.content);
+        }
+
+        void operator()(const op_push_style_t& v) const
+        {
+            m_ctx.style_stack.push_back(packed_font_style_t{ v.style });
+        }
+
+        void operator()(const op_push_packed_style_t& v) const
+        {
+            m_ctx.style_stack.push_back(v.style);
+        }
+
+        void operator()(const op_modify_style_t& v) const
+        {
+            m_ctx.style_stack.push_back(v.delta.apply(m_ctx.style_stack.back()));
+        }
+
+        void operator()(const op_apply_style_t& v) const
+        {
+            font_style_t style = m_ctx.style_stack.back().unpack();
+            v.applier(style);
+            m_ctx.style_stack.push_back(packed_font_style_t{ style });
+        }
+
+        void operator()(op_pop_style_t) const
+        {
+            m_ctx.style_stack.pop_back();
+        }
+
+        void operator()(op_placeholder_t) const
+        {
+            text({});
+        }
+
+        // Cursor and clear ops.
+        template <class Op>
+        void operator()(const Op&) const
+        {
+        }
+
+        void text(std::string_view content) const
+        {
+            if (m_ctx.new_line)
+            {
+                if (!m_ctx.collecting)
+                {
+                    close_span();
+                    write("\n");
+                }
+                write_indent();
+                m_ctx.new_line = false;
+            }
+            write_run(m_ctx.style_stack.back(), content);
+        }
+
+        // Draws the indentation with the guides render_fn uses, see render_fn::indent_prefix_cache_t.
+        void write_indent() const
+        {
+            const std::vector<render_fn::indent_guide_t>& guides = m_ctx.prefixes->m_guides;
+            for (std::size_t level = 0; level < static_cast<std::size_t>(m_ctx.indent_level); ++level)
+            {
+                const render_fn::indent_guide_t& guide = guides[std::min(level, guides.size() - 1)];
+                write_run(packed_font_style_t{ guide.style }, guide.text);
+            }
+        }
+
+        // Writes text in the given style, or only collects the style in the first pass.
+        void write_run(const packed_font_style_t style, std::string_view content) const
+        {
+            if (content.empty())
+            {
+                return;
+            }
+            if (m_ctx.collecting)
+            {
+                if (style != packed_font_style_t{})
+                {
+                    m_ctx.classes.insert(style);
+                }
+                return;
+            }
+            if (!m_ctx.span_open || m_ctx.span_style != style)
+            {
+                close_span();
+                if (style != packed_font_style_t{})
+                {
+                    write("<span class=\"ansi-");
+                    write_number(m_ctx.classes.at(style));
+                    write("\">");
+                    m_ctx.span_open = true;
+                    m_ctx.span_style = style;
+                }
+            }
+            write_escaped(content);
+        }
+
+        void close_span() const
+        {
+            if (m_ctx.span_open)
+            {
+                write("</span>");
+                m_ctx.span_open = false;
+            }
+        }
+
+        void write(std::string_view text) const
+        {
+            m_ctx.sink.append(text.data(), text.size());
+        }
+
+        void write_number(std::size_t value) const
+        {
+            char buffer[24];
+            const char* end = std::to_chars(buffer, buffer + sizeof(buffer), value).ptr;
+            m_ctx.sink.append(buffer, static_cast<std::size_t>(end - buffer));
+        }
+
+        void write_escaped(std::string_view text) const
+        {
+            std::size_t begin = 0;
+            for (std::size_t i = 0; i < text.size(); ++i)
+            {
+                std::string_view replacement;
+                switch (text[i])
+                {
+                    case '&': replacement = "&amp;"; break;
+                    case '<': replacement = "&lt;"; break;
+                    case '>': replacement = "&gt;"; break;
+                    default: continue;
+                }
+                write(text.substr(begin, i - begin));
+                write(replacement);
+                begin = i + 1;
+            }
+            write(text.substr(begin));
+        }
+    };
+
+    template <class Sink>
+    struct impl_t
+    {
+        mutable context_t<Sink> m_ctx;
+        render_fn::indent_prefix_cache_t* m_prefixes = nullptr;
+
+        impl_t(Sink sink) : m_ctx{ std::forward<Sink>(sink) }
+        {
+        }
+
+        // Draws indentation with the given prefixes, as render_fn::impl_t::indent_guides() does.
+        impl_t& indent_guides(render_fn::indent_prefix_cache_t& prefixes)
+        {
+            m_prefixes = &prefixes;
+            return *this;
+        }
+
+        template <class Stream, class = decltype(std::declval<const Stream&>().visit(std::declval<visitor_t<Sink>&>()))>
+        void operator()(const Stream& stream) const
+        {
+            // The default guides are the rendering thread's, looked up here rather than on construction.
+            m_ctx.prefixes = m_prefixes != nullptr ? m_prefixes : &render_fn::indent_prefix_cache_t::thread_local_instance();
+            m_ctx.collecting = true;
+            stream.visit(visitor_t<Sink>{ m_ctx });
+            reset();
+            write_stylesheet();
+
+            m_ctx.collecting = false;
+            stream.visit(visitor_t<Sink>{ m_ctx });
+            visitor_t<Sink> visitor{ m_ctx };
+            visitor.close_span();
+            visitor.write(m_ctx.new_line ? "\n</pre>\n" : "</pre>\n");
+            reset();
+            m_ctx.classes = class_table_t{};
+            m_ctx.sink.flush();
+        }
+
+    private:
+        void reset() const
+        {
+            m_ctx.style_stack.assign(1, packed_font_style_t{});
+            m_ctx.indent_level = 0;
+            m_ctx.new_line = false;
+            m_ctx.span_open = false;
+        }
+
+        void write_stylesheet() const
+        {
+            std::string css = "<style>\n.ansi { --ansi-fg: #e5e5e5; --ansi-bg: #000000; color: var(--ansi-fg); "
+                              "background-color: var(--ansi-bg); }\n";
+            for (std::size_t i = 0; i < m_ctx.classes.m_styles.size(); ++i)
+            {
+                css += ".ansi-";
+                css += std::to_string(i);
+                css += " {";
+                append_declarations(css, m_ctx.classes.m_styles[i].unpack());
+                css += " }\n";
+            }
+            css += "</style>\n<pre class=\"ansi\">";
+            m_ctx.sink.append(css.data(), css.size());
+        }
+    };
+
+    template <class Out>
+    auto operator()(Out& out) const -> impl_t<decltype(make_sink(out))>
+    {
+        return impl_t<decltype(make_sink(out))>{ make_sink(out) };
+    }
+
+    static void append_property(std::string& out, std::string_view name, const color_t& color)
+    {
+        const std::size_t size = out.size();
+        out += name;
+        if (append_color(out, color))
+        {
+            out += ";";
+        }
+        else
+        {
+            out.resize(size);
+        }
+    }
+
+    // Appends "#rrggbb", or returns false for the default color.
+    static bool append_color(std::string& out, const color_t& color)
+    {
+        struct color_visitor_t
+        {
+            bool operator()(default_color_t) const
+            {
+                return false;
+            }
+
+            bool operator()(standard_color_t col) const
+            {
+                return (*this)(palette_color_t{ col });
+            }
+
+            bool operator()(bright_color_t col) const
+            {
+                return (*this)(palette_color_t{ col });
+            }
+
+            bool operator()(palette_color_t col) const
+            {
+                return (*this)(col.to_rgb());
+            }
+
+            bool operator()(const rgb_color_t& col) const
+            {
+                static constexpr char digits[] = "0123456789abcdef";
+                m_out += '#';
+                for (const std::uint8_t v : col)
+                {
+                    m_out += digits[v >> 4];
+                    m_out += digits[v & 15];
+                }
+                return true;
+            }
+
+            std::string& m_out;
+        };
+        return std::visit(color_visitor_t{ out }, color.m_data);
+    }
+
+    static void append_declarations(std::string& out, const font_style_t& style)
+    {
+        if (style.font.contains(font_t::inverse))
+        {
+            out += " color: ";
+            if (!append_color(out, style.background))
+            {
+                out += "var(--ansi-bg)";
+            }
+            out += "; background-color: ";
+            if (!append_color(out, style.foreground))
+            {
+                out += "var(--ansi-fg)";
+            }
+            out += ";";
+        }
+        else
+        {
+            append_property(out, " color: ", style.foreground);
+            append_property(out, " background-color: ", style.background);
+        }
+        if (style.font.contains(font_t::bold))
+        {
+            out += " font-weight: bold;";
+        }
+        if (style.font.contains(font_t::dim))
+        {
+            out += " opacity: 0.5;";
+        }
+        if (style.font.contains(font_t::italic))
+        {
+            out += " font-style: italic;";
+        }
+        const bool underline = style.font.contains(font_t::underline | font_t::double_underline);
+        const bool crossed_out = style.font.contains(font_t::crossed_out);
+        if (underline || crossed_out)
+        {
+            out += " text-decoration-line:";
+            out += underline ? " underline" : "";
+            out += crossed_out ? " line-through" : "";
+            out += ";";
+        }
+        if (style.font.contains(font_t::double_underline))
+        {
+            out += " text-decoration-style: double;";
+        }
+        if (style.font.contains(font_t::hidden))
+        {
+            out += " visibility: hidden;";
+        }
+    }
+};
+
+constexpr inline auto render_html = render_html_fn{};
+
+}  // namespace ansi
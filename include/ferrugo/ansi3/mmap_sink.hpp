@@ -0,0 +1,146 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace ansi
+{
+
+// Sink writing a file through a memory-mapped window:
+//
+//     ansi::mmap_sink_t out{ "report.txt" };
+//     ansi::render(out)(stream);
+//     out.close();
+//
+// The file is grown by one extent at a time with ftruncate() and the window is moved forward over each new extent,
+// so rendered bytes are copied once, straight into the page cache. close() (or the destructor) truncates the file to
+// the number of bytes written.
+struct mmap_sink_t
+{
+    explicit mmap_sink_t(const std::string& path, std::size_t extent_size = 64 << 20)
+        : m_fd{ ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644) }
+        , m_extent_size{ round_to_pages(extent_size) }
+    {
+        if (m_fd < 0)
+        {
+            fail("open");
+        }
+    }
+
+    mmap_sink_t(const mmap_sink_t&) = delete;
+    mmap_sink_t& operator=(const mmap_sink_t&) = delete;
+
+    ~mmap_sink_t()
+    {
+        try
+        {
+            close();
+        }
+        catch (...)
+        {
+        }
+    }
+
+    void append(const char* data, std::size_t size)
+    {
+        while (size > 0)
+        {
+            if (m_window == nullptr || m_position == m_extent_size)
+            {
+                advance();
+            }
+            const std::size_t chunk = std::min(size, m_extent_size - m_position);
+            std::memcpy(m_window + m_position, data, chunk);
+            m_position += chunk;
+            data += chunk;
+            size -= chunk;
+        }
+    }
+
+    // The bytes are already in the mapping; the kernel writes them back.
+    void flush()
+    {
+    }
+
+    void close()
+    {
+        if (m_fd < 0)
+        {
+            return;
+        }
+        const std::size_t final_size = size();
+        unmap();
+        const int fd = m_fd;
+        m_fd = -1;
+        const bool truncated = ::ftruncate(fd, static_cast<off_t>(final_size)) == 0;
+        const int error = errno;
+        ::close(fd);
+        if (!truncated)
+        {
+            errno = error;
+            fail("ftruncate");
+        }
+    }
+
+    // Bytes written so far.
+    std::size_t size() const
+    {
+        return m_window_offset + m_position;
+    }
+
+private:
+    int m_fd;
+    std::size_t m_extent_size;
+    char* m_window = nullptr;
+    std::size_t m_window_offset = 0;
+    std::size_t m_position = 0;
+
+    void advance()
+    {
+        const std::size_t offset = m_window != nullptr ? m_window_offset + m_extent_size : 0;
+        unmap();
+        if (::ftruncate(m_fd, static_cast<off_t>(offset + m_extent_size)) != 0)
+        {
+            fail("ftruncate");
+        }
+        void* window
+            = ::mmap(nullptr, m_extent_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, static_cast<off_t>(offset));
+        if (window == MAP_FAILED)
+        {
+            fail("mmap");
+        }
+        ::madvise(window, m_extent_size, MADV_SEQUENTIAL);
+        m_window = static_cast<char*>(window);
+        m_window_offset = offset;
+        m_position = 0;
+    }
+
+    void unmap()
+    {
+        if (m_window != nullptr)
+        {
+            ::munmap(m_window, m_extent_size);
+            m_window = nullptr;
+        }
+    }
+
+    static std::size_t round_to_pages(std::size_t size)
+    {
+        const std::size_t page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+        return std::max<std::size_t>((size + page - 1) / page * page, page);
+    }
+
+    [[noreturn]] static void fail(const char* what)
+    {
+        throw std::system_error{ errno, std::generic_category(), std::string{ "mmap_sink_t: " } + what };
+    }
+};
+
+}  // namespace ansi
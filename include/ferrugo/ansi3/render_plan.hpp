@@ -0,0 +1,163 @@
+#pragma once
+
+#include <ferrugo/ansi3/stream.hpp>
+#include <initializer_list>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace ansi
+{
+
+// The value of a placeholder: text, optionally with a style change applied on top of the style in effect there.
+struct plan_value_t
+{
+    std::string_view text;
+    style_delta_t style;
+
+    template <class Text, class = std::enable_if_t<std::is_convertible_v<const Text&, std::string_view>>>
+    plan_value_t(const Text& text, style_delta_t style = {}) : text{ text }, style{ style }
+    {
+    }
+};
+
+// A stream compiled for rendering many times with different values in its placeholders:
+//
+//     const ansi::render_plan_t plan{ ansi::stream_t{}(
+//         ansi::line(ansi::change_style(ansi::bold)(ansi::placeholder(0)), ": ", ansi::placeholder(1))) };
+//     plan(std::cout, { "disk", { "98%", ansi::red } });
+//
+// Compiling renders the stream once and records where each placeholder falls and which style is in effect there, so
+// everything but the values (text, indentation, line breaks and style changes) is encoded up front. Rendering copies
+// the encoded spans and writes each value in between. A value with a style is wrapped in the transitions to that style
+// and back, so the encoded bytes that follow still start from the style they were encoded for. Without styled values
+// the output is the same as rendering the stream with each placeholder replaced by the text of its value.
+//
+// Transitions of styled values are cached in the plan, so one plan must not be rendered from several threads at once.
+struct render_plan_t
+{
+    struct slot_t
+    {
+        std::size_t m_offset;
+        std::size_t m_index;
+        packed_font_style_t m_style;
+    };
+
+    std::string m_bytes;
+    std::vector<slot_t> m_slots;
+    std::size_t m_value_count = 0;
+    sanitize_mode_t m_sanitize = sanitize_mode_t::none;
+    mutable render_fn::style_transition_cache_t m_cache;
+
+    template <
+        class Stream,
+        class = decltype(std::declval<const Stream&>().visit(std::declval<const render_fn::visitor_t<string_sink_t>&>()))>
+    explicit render_plan_t(
+        const Stream& stream,
+        color_depth_t color_depth = color_depth_t::truecolor,
+        const color_quantizer_t* quantizer = nullptr)
+        : m_bytes{}
+        , m_slots{}
+        , m_value_count{}
+        , m_sanitize{}
+        , m_cache{ 64, color_depth }
+    {
+        m_cache.set_color_depth(color_depth, quantizer);
+        render_fn::context_t<string_sink_t> ctx{ make_sink(m_bytes),
+                                                 0,
+                                                 false,
+                                                 { packed_font_style_t{} },
+                                                 &m_cache,
+                                                 &render_fn::indent_prefix_cache_t::thread_local_instance() };
+        stream.visit(compiler_t{ render_fn::visitor_t<string_sink_t>{ ctx }, *this });
+        if (ctx.new_line)
+        {
+            m_bytes += '\n';
+        }
+    }
+
+    // The number of values a render needs: one more than the highest placeholder index.
+    std::size_t value_count() const
+    {
+        return m_value_count;
+    }
+
+    // Escapes or strips control characters in the values, see sanitize_fn. The encoded parts are left as they are.
+    render_plan_t& sanitize(sanitize_mode_t mode = sanitize_mode_t::escape)
+    {
+        m_sanitize = mode;
+        return *this;
+    }
+
+    template <class Out>
+    void operator()(Out& out, std::initializer_list<plan_value_t> values) const
+    {
+        render(make_sink(out), values.begin(), values.size());
+    }
+
+    template <class Out>
+    void operator()(Out& out, const std::vector<plan_value_t>& values) const
+    {
+        render(make_sink(out), values.data(), values.size());
+    }
+
+private:
+    // Renders the stream as usual and notes the position and style of each placeholder.
+    struct compiler_t
+    {
+        render_fn::visitor_t<string_sink_t> m_visitor;
+        render_plan_t& m_plan;
+
+        template <class Op>
+        void operator()(const Op& op) const
+        {
+            m_visitor(op);
+        }
+
+        void operator()(op_placeholder_t v) const
+        {
+            m_visitor(v);
+            m_plan.m_slots.push_back(slot_t{ m_plan.m_bytes.size(), v.index, m_visitor.m_ctx.style_stack.back() });
+            m_plan.m_value_count = std::max(m_plan.m_value_count, v.index + 1);
+        }
+    };
+
+    template <class Sink>
+    void render(Sink&& sink, const plan_value_t* values, std::size_t count) const
+    {
+        if (count < m_value_count)
+        {
+            throw std::invalid_argument{ "render_plan_t: missing placeholder values" };
+        }
+        std::size_t offset = 0;
+        for (const slot_t& slot : m_slots)
+        {
+            sink.append(m_bytes.data() + offset, slot.m_offset - offset);
+            offset = slot.m_offset;
+            write_value(sink, values[slot.m_index], slot.m_style);
+        }
+        sink.append(m_bytes.data() + offset, m_bytes.size() - offset);
+        sink.flush();
+    }
+
+    template <class Sink>
+    void write_value(Sink& sink, const plan_value_t& value, const packed_font_style_t base_style) const
+    {
+        const packed_font_style_t style = value.style.apply(base_style);
+        if (style != base_style)
+        {
+            const std::string_view change = m_cache.get(base_style, style);
+            sink.append(change.data(), change.size());
+        }
+        ansi::sanitize(sink, value.text, m_sanitize);
+        if (style != base_style)
+        {
+            const std::string_view change = m_cache.get(style, base_style);
+            sink.append(change.data(), change.size());
+        }
+    }
+};
+
+}  // namespace ansi
@@ -0,0 +1,206 @@
+#pragma once
+
+#include <cstddef>
+#include <ferrugo/ansi3/sink.hpp>
+#include <string_view>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace ansi
+{
+
+// What render does with control characters in text, see render_fn::impl_t::sanitize(). Text from untrusted sources
+// (log fields, file names) may contain escape sequences that restyle the terminal, move the cursor or set the window
+// title, or BEL and carriage returns that hide what was printed.
+enum class sanitize_mode_t
+{
+    none,
+    escape,
+    strip,
+};
+
+// Writes text with its control characters removed or made visible. Control characters are the C0 controls except
+// tab and line feed, DEL, and the C1 controls U+0080 to U+009F as encoded in UTF-8 (C2 80 to C2 9F). A C2 byte that
+// ends the text counts as a control character too, since the next text written could complete a C1 control. In
+// escape mode each of their bytes is written as \xNN and each backslash as \\, so that escaped output cannot be
+// mistaken for text that spells an escape; in strip mode control characters are dropped and backslashes kept.
+//
+// The text is scanned 64 bytes at a time with SSE2 where available. Runs of clean text are passed to the sink as they
+// are (through append_ref when the sink has it), so text without control characters costs one scan and one write.
+constexpr inline struct sanitize_fn
+{
+    template <class Sink>
+    void operator()(Sink& sink, std::string_view text, sanitize_mode_t mode) const
+    {
+        const char* ptr = text.data();
+        const char* const end = ptr + text.size();
+        while (true)
+        {
+            const char* const control = mode == sanitize_mode_t::none     ? end
+                                        : mode == sanitize_mode_t::escape ? find_control<true>(ptr, end)
+                                                                          : find_control(ptr, end);
+            if (control != ptr)
+            {
+                write_clean(sink, ptr, static_cast<std::size_t>(control - ptr));
+            }
+            if (control == end)
+            {
+                return;
+            }
+            if (*control == '\\')
+            {
+                sink.append("\\\\", 2);
+                ptr = control + 1;
+                continue;
+            }
+            const std::size_t size = control_size(control, end);
+            if (mode == sanitize_mode_t::escape)
+            {
+                static constexpr char digits[] = "0123456789abcdef";
+                for (std::size_t i = 0; i < size; ++i)
+                {
+                    const auto byte = static_cast<unsigned char>(control[i]);
+                    const char escaped[4] = { '\\', 'x', digits[byte >> 4], digits[byte & 15] };
+                    sink.append(escaped, sizeof(escaped));
+                }
+            }
+            ptr = control + size;
+        }
+    }
+
+    // The first control character in [ptr, end), or end. With Backslash, backslashes are found as well.
+    template <bool Backslash = false>
+    static const char* find_control(const char* ptr, const char* const end)
+    {
+#if defined(__SSE2__)
+        if (end - ptr > 16)
+        {
+            // Skips 64 bytes per step while no byte could start a control character, then checks each 16-byte block
+            // exactly. Blocks are read with one byte of lookahead for the C1 test, hence the strict comparisons.
+            for (; end - ptr > 64; ptr += 64)
+            {
+                const __m128i any = _mm_or_si128(
+                    _mm_or_si128(candidates<Backslash>(ptr), candidates<Backslash>(ptr + 16)),
+                    _mm_or_si128(candidates<Backslash>(ptr + 32), candidates<Backslash>(ptr + 48)));
+                if (_mm_movemask_epi8(any) == 0)
+                {
+                    continue;
+                }
+                for (int offset = 0; offset < 64; offset += 16)
+                {
+                    if (const int mask = _mm_movemask_epi8(controls<Backslash>(ptr + offset)); mask != 0)
+                    {
+                        return ptr + offset + __builtin_ctz(static_cast<unsigned>(mask));
+                    }
+                }
+            }
+            for (; end - ptr > 16; ptr += 16)
+            {
+                if (const int mask = _mm_movemask_epi8(controls<Backslash>(ptr)); mask != 0)
+                {
+                    return ptr + __builtin_ctz(static_cast<unsigned>(mask));
+                }
+            }
+            // At most 16 bytes are left: the block ending at the last byte overlaps bytes already found clean, which
+            // stay unmarked. The last byte itself has no lookahead and is checked on its own.
+            if (const int mask = _mm_movemask_epi8(controls<Backslash>(end - 17)); mask != 0)
+            {
+                return end - 17 + __builtin_ctz(static_cast<unsigned>(mask));
+            }
+            return ptr != end && is_control<Backslash>(end - 1, end) ? end - 1 : end;
+        }
+#endif
+        for (; ptr != end; ++ptr)
+        {
+            if (is_control<Backslash>(ptr, end))
+            {
+                return ptr;
+            }
+        }
+        return end;
+    }
+
+    // The size in bytes of the control character at ptr, or 0 if there is none.
+    static std::size_t control_size(const char* ptr, const char* const end)
+    {
+        const auto ch = static_cast<unsigned char>(*ptr);
+        if ((ch < 0x20 && ch != '\t' && ch != '\n') || ch == 0x7F)
+        {
+            return 1;
+        }
+        if (ch == 0xC2)
+        {
+            if (end - ptr < 2)
+            {
+                return 1;
+            }
+            const auto next = static_cast<unsigned char>(ptr[1]);
+            return next >= 0x80 && next <= 0x9F ? 2 : 0;
+        }
+        return 0;
+    }
+
+private:
+    template <bool Backslash>
+    static bool is_control(const char* ptr, const char* const end)
+    {
+        return control_size(ptr, end) != 0 || (Backslash && *ptr == '\\');
+    }
+
+#if defined(__SSE2__)
+    // C0 controls other than tab and line feed, and DEL, among the 16 bytes v; with Backslash, also backslashes.
+    template <bool Backslash>
+    static __m128i single_byte_controls(const __m128i v)
+    {
+        const __m128i c0 = _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(0x1F)), v);
+        const __m128i allowed
+            = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\t')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+        const __m128i result = _mm_or_si128(_mm_andnot_si128(allowed, c0), _mm_cmpeq_epi8(v, _mm_set1_epi8(0x7F)));
+        if constexpr (Backslash)
+        {
+            return _mm_or_si128(result, _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+        }
+        return result;
+    }
+
+    // Marks the bytes of the 16 at ptr that may start a control character. Most C2 bytes are the lead byte of an
+    // ordinary character such as U+00B0, so this is a cheap filter for controls().
+    template <bool Backslash>
+    static __m128i candidates(const char* ptr)
+    {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr));
+        return _mm_or_si128(single_byte_controls<Backslash>(v), _mm_cmpeq_epi8(v, _mm_set1_epi8(static_cast<char>(0xC2))));
+    }
+
+    // Marks the bytes of the 16 at ptr that start a control character. Reads 17 bytes.
+    template <bool Backslash>
+    static __m128i controls(const char* ptr)
+    {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr));
+        const __m128i next = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr + 1));
+        // C2 followed by 80 to 9F, which xor 80 maps to 00 to 1F.
+        const __m128i c1_tail = _mm_xor_si128(next, _mm_set1_epi8(static_cast<char>(0x80)));
+        const __m128i c1 = _mm_and_si128(
+            _mm_cmpeq_epi8(v, _mm_set1_epi8(static_cast<char>(0xC2))),
+            _mm_cmpeq_epi8(_mm_min_epu8(c1_tail, _mm_set1_epi8(0x1F)), c1_tail));
+        return _mm_or_si128(single_byte_controls<Backslash>(v), c1);
+    }
+#endif
+
+    template <class Sink>
+    static void write_clean(Sink& sink, const char* data, std::size_t size)
+    {
+        if constexpr (has_append_ref_v<Sink>)
+        {
+            sink.append_ref(data, size);
+        }
+        else
+        {
+            sink.append(data, size);
+        }
+    }
+} sanitize{};
+
+}  // namespace ansi
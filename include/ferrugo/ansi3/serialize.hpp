@@ -0,0 +1,413 @@
+#pragma once
+
+#include <cstring>
+#include <fcntl.h>
+#include <ferrugo/ansi3/compact_stream.hpp>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+#include <vector>
+
+namespace ansi
+{
+
+// Binary form of an op stream, written by serialize and read in place by serialized_view_t / mapped_stream_t.
+// All integers are little-endian.
+//
+//     offset  size          field
+//     0       4             magic "FANS"
+//     4       4             format version
+//     8       8             op count
+//     16      8             style count
+//     24      8             code size
+//     32      8             text size
+//     40      8 * styles    packed_font_style_t values
+//     ...     code size     compact_stream_t opcodes and operands
+//     ...     text size     text pool
+//
+// Style changes are stored as pushes of concrete styles, so op_modify_style_t and op_apply_style_t (which may hold
+// arbitrary functions) are resolved against the style stack when serializing and never appear in the code.
+struct serialized_format_t
+{
+    static constexpr char magic[4] = { 'F', 'A', 'N', 'S' };
+    // Version 2 added opcode_t::placeholder.
+    static constexpr std::uint32_t version = 2;
+    static constexpr std::size_t header_size = 40;
+
+    static void put_u32(char* out, std::uint32_t value)
+    {
+        for (int i = 0; i < 4; ++i)
+        {
+            out[i] = static_cast<char>(value >> (8 * i));
+        }
+    }
+
+    static void put_u64(char* out, std::uint64_t value)
+    {
+        for (int i = 0; i < 8; ++i)
+        {
+            out[i] = static_cast<char>(value >> (8 * i));
+        }
+    }
+
+    static std::uint32_t get_u32(const unsigned char* in)
+    {
+        std::uint32_t result = 0;
+        for (int i = 0; i < 4; ++i)
+        {
+            result |= std::uint32_t(in[i]) << (8 * i);
+        }
+        return result;
+    }
+
+    static std::uint64_t get_u64(const unsigned char* in)
+    {
+        std::uint64_t result = 0;
+        for (int i = 0; i < 8; ++i)
+        {
+            result |= std::uint64_t(in[i]) << (8 * i);
+        }
+        return result;
+    }
+};
+
+// Renders a serialized stream held in memory without decoding it into ops first. The memory must outlive the view.
+struct serialized_view_t
+{
+    struct style_table_t
+    {
+        const unsigned char* m_data;
+
+        packed_font_style_t operator[](std::size_t index) const
+        {
+            return packed_font_style_t{ serialized_format_t::get_u64(m_data + 8 * index) };
+        }
+    };
+
+    struct no_appliers_t
+    {
+        const op_apply_style_t& operator[](std::size_t) const
+        {
+            throw std::runtime_error{ "serialized stream: unexpected apply_style op" };
+        }
+    };
+
+    std::size_t m_op_count = 0;
+    style_table_t m_styles = { nullptr };
+    const std::uint8_t* m_code = nullptr;
+    std::size_t m_code_size = 0;
+    const char* m_text = nullptr;
+
+    serialized_view_t() = default;
+
+    serialized_view_t(const void* data, std::size_t size)
+    {
+        const auto* bytes = static_cast<const unsigned char*>(data);
+        if (size < serialized_format_t::header_size || std::memcmp(bytes, serialized_format_t::magic, 4) != 0)
+        {
+            throw std::runtime_error{ "serialized stream: bad header" };
+        }
+        if (serialized_format_t::get_u32(bytes + 4) != serialized_format_t::version)
+        {
+            throw std::runtime_error{ "serialized stream: unsupported version" };
+        }
+        const std::uint64_t op_count = serialized_format_t::get_u64(bytes + 8);
+        const std::uint64_t style_count = serialized_format_t::get_u64(bytes + 16);
+        const std::uint64_t code_size = serialized_format_t::get_u64(bytes + 24);
+        const std::uint64_t text_size = serialized_format_t::get_u64(bytes + 32);
+        const std::uint64_t available = size - serialized_format_t::header_size;
+        if (style_count > available / 8 || code_size > available - 8 * style_count
+            || text_size > available - 8 * style_count - code_size)
+        {
+            throw std::runtime_error{ "serialized stream: truncated" };
+        }
+        m_op_count = static_cast<std::size_t>(op_count);
+        m_styles = style_table_t{ bytes + serialized_format_t::header_size };
+        m_code = bytes + serialized_format_t::header_size + 8 * style_count;
+        m_code_size = static_cast<std::size_t>(code_size);
+        m_text = reinterpret_cast<const char*>(m_code + m_code_size);
+        validate(m_code, m_code + m_code_size, op_count, style_count, text_size);
+    }
+
+    std::size_t size() const
+    {
+        return m_op_count;
+    }
+
+    template <class Visitor>
+    void visit(Visitor&& visitor) const
+    {
+        compact_stream_t::decode(m_code, m_code + m_code_size, m_text, m_styles, no_appliers_t{}, visitor);
+    }
+
+private:
+    // Walks the code once, so that visit() can decode it unchecked: every opcode is known, every operand lies within
+    // the code, style indices are within the style table, the text ops use no more than the text pool, and every
+    // pop_style has a style to pop, which the renderers assume.
+    static void validate(
+        const std::uint8_t* ptr,
+        const std::uint8_t* const end,
+        std::uint64_t op_count,
+        std::uint64_t style_count,
+        std::uint64_t text_size)
+    {
+        std::uint64_t ops = 0;
+        std::uint64_t text = 0;
+        std::uint64_t style_depth = 0;
+        for (; ptr != end; ++ops)
+        {
+            switch (static_cast<opcode_t>(*ptr++))
+            {
+                case opcode_t::new_line:
+                case opcode_t::indent:
+                case opcode_t::unindent: break;
+                case opcode_t::pop_style:
+                    if (style_depth == 0)
+                    {
+                        fail();
+                    }
+                    style_depth -= 1;
+                    break;
+                case opcode_t::text:
+                {
+                    const std::uint64_t size = read_varint(ptr, end);
+                    if (size > text_size - text)
+                    {
+                        fail();
+                    }
+                    text += size;
+                    break;
+                }
+                case opcode_t::push_style:
+                    if (read_varint(ptr, end) >= style_count)
+                    {
+                        fail();
+                    }
+                    style_depth += 1;
+                    break;
+                case opcode_t::modify_style:
+                    for (int i = 0; i < 4; ++i)
+                    {
+                        read_varint(ptr, end);
+                    }
+                    style_depth += 1;
+                    break;
+                case opcode_t::move_cursor:
+                    read_byte(ptr, end, static_cast<std::uint8_t>(direction_t::column));
+                    read_varint(ptr, end);
+                    break;
+                case opcode_t::move_cursor_to:
+                    read_varint(ptr, end);
+                    read_varint(ptr, end);
+                    break;
+                case opcode_t::clear_screen:
+                    read_byte(ptr, end, static_cast<std::uint8_t>(clear_screen_mode_t::scrollback));
+                    break;
+                case opcode_t::clear_line:
+                    read_byte(ptr, end, static_cast<std::uint8_t>(clear_line_mode_t::to_begin));
+                    break;
+                case opcode_t::set_cursor_visibility: read_byte(ptr, end, 1); break;
+                case opcode_t::placeholder: read_varint(ptr, end); break;
+                default: fail();
+            }
+        }
+        if (ops != op_count)
+        {
+            fail();
+        }
+    }
+
+    [[noreturn]] static void fail()
+    {
+        throw std::runtime_error{ "serialized stream: corrupted code" };
+    }
+
+    static std::uint64_t read_varint(const std::uint8_t*& ptr, const std::uint8_t* const end)
+    {
+        std::uint64_t result = 0;
+        for (int shift = 0; shift < 64 && ptr != end; shift += 7)
+        {
+            const std::uint8_t byte = *ptr++;
+            result |= std::uint64_t(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+            {
+                return result;
+            }
+        }
+        fail();
+    }
+
+    static void read_byte(const std::uint8_t*& ptr, const std::uint8_t* const end, std::uint8_t max)
+    {
+        if (ptr == end || *ptr > max)
+        {
+            fail();
+        }
+        ++ptr;
+    }
+};
+
+// A serialized stream file mapped read-only into memory.
+//
+//     ansi::mapped_stream_t doc{ "status.fans" };
+//     ansi::render(std::cout)(doc);
+struct mapped_stream_t
+{
+    explicit mapped_stream_t(const std::string& path)
+    {
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            throw std::system_error{ errno, std::generic_category(), "mapped_stream_t: open" };
+        }
+        struct stat info = {};
+        if (::fstat(fd, &info) != 0)
+        {
+            const int error = errno;
+            ::close(fd);
+            throw std::system_error{ error, std::generic_category(), "mapped_stream_t: fstat" };
+        }
+        m_size = static_cast<std::size_t>(info.st_size);
+        void* data = m_size > 0 ? ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        const int error = errno;
+        ::close(fd);
+        if (data == MAP_FAILED)
+        {
+            throw std::system_error{ m_size > 0 ? error : EINVAL, std::generic_category(), "mapped_stream_t: mmap" };
+        }
+        m_data = data;
+        try
+        {
+            m_view = serialized_view_t{ m_data, m_size };
+        }
+        catch (...)
+        {
+            ::munmap(m_data, m_size);
+            throw;
+        }
+    }
+
+    mapped_stream_t(const mapped_stream_t&) = delete;
+    mapped_stream_t& operator=(const mapped_stream_t&) = delete;
+
+    ~mapped_stream_t()
+    {
+        ::munmap(m_data, m_size);
+    }
+
+    std::size_t size() const
+    {
+        return m_view.size();
+    }
+
+    template <class Visitor>
+    void visit(Visitor&& visitor) const
+    {
+        m_view.visit(std::forward<Visitor>(visitor));
+    }
+
+private:
+    void* m_data = nullptr;
+    std::size_t m_size = 0;
+    serialized_view_t m_view;
+};
+
+// Writes any op source (stream_t, compact_stream_t, serialized_view_t...) in the serialized form.
+//
+//     std::ofstream file{ "status.fans", std::ios::binary };
+//     ansi::serialize(stream, file);
+struct serialize_fn
+{
+    // Forwards ops to a compact_stream_t, replacing style changes with pushes of the resulting styles.
+    struct visitor_t
+    {
+        compact_stream_t& m_out;
+        std::vector<packed_font_style_t>& m_style_stack;
+
+        template <class Op>
+        void operator()(const Op& op) const
+        {
+            m_out << op;
+        }
+
+        void operator()(const op_push_style_t& v) const
+        {
+            push(packed_font_style_t{ v.style });
+        }
+
+        void operator()(op_push_packed_style_t v) const
+        {
+            push(v.style);
+        }
+
+        void operator()(op_modify_style_t v) const
+        {
+            push(v.delta.apply(m_style_stack.back()));
+        }
+
+        void operator()(const op_apply_style_t& v) const
+        {
+            font_style_t style = m_style_stack.back().unpack();
+            v.applier(style);
+            push(packed_font_style_t{ style });
+        }
+
+        void operator()(op_pop_style_t v) const
+        {
+            if (m_style_stack.size() > 1)
+            {
+                m_style_stack.pop_back();
+            }
+            m_out << v;
+        }
+
+        void push(packed_font_style_t style) const
+        {
+            m_style_stack.push_back(style);
+            m_out << op_push_packed_style_t{ style };
+        }
+    };
+
+    template <class Stream>
+    void operator()(const Stream& stream, std::ostream& os) const
+    {
+        compact_stream_t compact;
+        std::vector<packed_font_style_t> style_stack = { packed_font_style_t{} };
+        stream.visit(visitor_t{ compact, style_stack });
+
+        char header[serialized_format_t::header_size] = {};
+        std::memcpy(header, serialized_format_t::magic, 4);
+        serialized_format_t::put_u32(header + 4, serialized_format_t::version);
+        serialized_format_t::put_u64(header + 8, compact.size());
+        serialized_format_t::put_u64(header + 16, compact.m_styles.size());
+        serialized_format_t::put_u64(header + 24, compact.m_code.size());
+        serialized_format_t::put_u64(header + 32, compact.m_text.size());
+        os.write(header, sizeof(header));
+        for (const packed_font_style_t style : compact.m_styles)
+        {
+            char bytes[8];
+            serialized_format_t::put_u64(bytes, style.m_value);
+            os.write(bytes, sizeof(bytes));
+        }
+        os.write(
+            reinterpret_cast<const char*>(compact.m_code.data()), static_cast<std::streamsize>(compact.m_code.size()));
+        os.write(compact.m_text.data(), static_cast<std::streamsize>(compact.m_text.size()));
+    }
+
+    template <class Stream>
+    std::string operator()(const Stream& stream) const
+    {
+        std::ostringstream os;
+        (*this)(stream, os);
+        return os.str();
+    }
+};
+
+constexpr inline auto serialize = serialize_fn{};
+
+}  // namespace ansi
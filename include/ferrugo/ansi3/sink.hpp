@@ -0,0 +1,177 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace ansi
+{
+
+// A sink receives rendered bytes. It provides
+//
+//     void append(const char* data, std::size_t size);
+//     void flush();
+//
+// flush() is called once at the end of each render. A sink may also provide
+//
+//     void append_ref(const char* data, std::size_t size);
+//
+// which render uses for text ops. The text stays valid until the next flush(), so the sink may keep a pointer to it
+// instead of copying it.
+
+template <class T, class = void>
+struct is_sink : std::false_type
+{
+};
+
+template <class T>
+struct is_sink<
+    T,
+    std::void_t<
+        decltype(std::declval<T&>().append(std::declval<const char*>(), std::declval<std::size_t>())),
+        decltype(std::declval<T&>().flush())>> : std::true_type
+{
+};
+
+template <class T>
+constexpr inline bool is_sink_v = is_sink<T>::value;
+
+template <class T, class = void>
+struct has_append_ref : std::false_type
+{
+};
+
+template <class T>
+struct has_append_ref<
+    T,
+    std::void_t<decltype(std::declval<T&>().append_ref(std::declval<const char*>(), std::declval<std::size_t>()))>>
+    : std::true_type
+{
+};
+
+template <class T>
+constexpr inline bool has_append_ref_v = has_append_ref<T>::value;
+
+struct string_sink_t
+{
+    std::string& m_out;
+
+    void append(const char* data, std::size_t size)
+    {
+        m_out.append(data, size);
+    }
+
+    void flush()
+    {
+    }
+};
+
+struct vector_sink_t
+{
+    std::vector<char>& m_out;
+
+    void append(const char* data, std::size_t size)
+    {
+        m_out.insert(m_out.end(), data, data + size);
+    }
+
+    void flush()
+    {
+    }
+};
+
+// Writes into a caller-provided buffer. Output that does not fit is dropped and reported by overflow().
+struct buffer_sink_t
+{
+    char* m_data;
+    std::size_t m_capacity;
+    std::size_t m_size = 0;
+    bool m_overflow = false;
+
+    buffer_sink_t(char* data, std::size_t capacity) : m_data{ data }, m_capacity{ capacity }
+    {
+    }
+
+    template <std::size_t N>
+    explicit buffer_sink_t(char (&data)[N]) : buffer_sink_t{ data, N }
+    {
+    }
+
+    void append(const char* data, std::size_t size)
+    {
+        if (size > m_capacity - m_size)
+        {
+            size = m_capacity - m_size;
+            m_overflow = true;
+        }
+        std::memcpy(m_data + m_size, data, size);
+        m_size += size;
+    }
+
+    void flush()
+    {
+    }
+
+    std::size_t size() const
+    {
+        return m_size;
+    }
+
+    bool overflow() const
+    {
+        return m_overflow;
+    }
+
+    std::string_view view() const
+    {
+        return { m_data, m_size };
+    }
+
+    void clear()
+    {
+        m_size = 0;
+        m_overflow = false;
+    }
+};
+
+// Forwards to an std::ostream. flush() leaves the stream's own buffering alone.
+struct ostream_sink_t
+{
+    std::ostream& m_os;
+
+    void append(const char* data, std::size_t size)
+    {
+        m_os.write(data, static_cast<std::streamsize>(size));
+    }
+
+    void flush()
+    {
+    }
+};
+
+inline ostream_sink_t make_sink(std::ostream& os)
+{
+    return ostream_sink_t{ os };
+}
+
+inline string_sink_t make_sink(std::string& out)
+{
+    return string_sink_t{ out };
+}
+
+inline vector_sink_t make_sink(std::vector<char>& out)
+{
+    return vector_sink_t{ out };
+}
+
+template <class Sink, std::enable_if_t<is_sink_v<Sink>, int> = 0>
+Sink& make_sink(Sink& sink)
+{
+    return sink;
+}
+
+}  // namespace ansi
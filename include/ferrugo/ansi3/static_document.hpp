@@ -0,0 +1,202 @@
+#pragma once
+
+#include <array>
+#include <cassert>
+#include <ferrugo/ansi3/stream.hpp>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+namespace ansi
+{
+
+// The rendered bytes of a document built at compile time, see static_document.
+template <std::size_t Size>
+struct static_document_t
+{
+    std::array<char, Size> m_data;
+
+    constexpr const char* data() const
+    {
+        return m_data.data();
+    }
+
+    constexpr std::size_t size() const
+    {
+        return Size;
+    }
+
+    constexpr std::string_view view() const
+    {
+        return { data(), size() };
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, const static_document_t& item)
+    {
+        return os.write(item.data(), static_cast<std::streamsize>(item.size()));
+    }
+};
+
+// Renders documents made of constant parts at compile time:
+//
+//     static constexpr auto banner = ansi::static_document(
+//         []
+//         {
+//             return ansi::make_sequence(
+//                 ansi::line(ansi::change_style(ansi::bold | ansi::cyan)("mytool"), " 1.2.0"),
+//                 ansi::indented(ansi::line("usage: mytool [options] <file>")));
+//         });
+//     std::cout << banner;
+//
+// The builder is a lambda returning the document; it is called in a constant expression, once to measure the output
+// and once to write it, so the result is an array of exactly the rendered size. Documents may use line, indented,
+// set_style, change_style with a style_delta_t, text_ref, push_style, modify_style with a style_delta_t, pop_style
+// and string literals; the bytes are the same as render(out)(stream_t{ document }) gives with the default indent
+// guides and full color depth.
+constexpr inline struct static_document_fn
+{
+    // Mirrors render_fn::visitor_t. With Capacity = 0 only the size is counted.
+    template <std::size_t Capacity>
+    struct writer_t
+    {
+        static constexpr std::size_t max_style_depth = 64;
+
+        std::array<char, Capacity> m_data = {};
+        std::size_t m_size = 0;
+        int m_indent_level = 0;
+        bool m_new_line = false;
+        std::array<packed_font_style_t, max_style_depth> m_style_stack = {};
+        std::size_t m_style_depth = 1;
+
+        constexpr writer_t& operator<<(op_new_line_t)
+        {
+            m_new_line = true;
+            return *this;
+        }
+
+        constexpr writer_t& operator<<(op_indent_t)
+        {
+            m_indent_level += 1;
+            return *this;
+        }
+
+        constexpr writer_t& operator<<(op_unindent_t)
+        {
+            m_indent_level = m_indent_level > 0 ? m_indent_level - 1 : 0;
+            return *this;
+        }
+
+        constexpr writer_t& operator<<(op_text_ref_t v)
+        {
+            return *this << v.content;
+        }
+
+        constexpr writer_t& operator<<(std::string_view text)
+        {
+            if (m_new_line)
+            {
+                write("\033[0m\n");
+                for (int i = 0; i < m_indent_level; ++i)
+                {
+                    write("  ");
+                }
+                m_new_line = false;
+                write_style_change(packed_font_style_t{}, m_style_stack[m_style_depth - 1]);
+            }
+            write(text);
+            return *this;
+        }
+
+        constexpr writer_t& operator<<(const char* text)
+        {
+            return *this << std::string_view{ text };
+        }
+
+        constexpr writer_t& operator<<(const op_push_style_t& v)
+        {
+            return push(packed_font_style_t{ v.style });
+        }
+
+        constexpr writer_t& operator<<(op_push_packed_style_t v)
+        {
+            return push(v.style);
+        }
+
+        constexpr writer_t& operator<<(op_modify_style_t v)
+        {
+            return push(v.delta.apply(m_style_stack[m_style_depth - 1]));
+        }
+
+        constexpr writer_t& operator<<(op_pop_style_t)
+        {
+            assert(m_style_depth > 1);
+            m_style_depth -= 1;
+            write_style_change(m_style_stack[m_style_depth], m_style_stack[m_style_depth - 1]);
+            return *this;
+        }
+
+        template <class... Items>
+        constexpr writer_t& operator<<(const sequence_t<Items...>& sequence)
+        {
+            sequence(*this);
+            return *this;
+        }
+
+        constexpr void finish()
+        {
+            if (m_new_line)
+            {
+                write("\n");
+            }
+        }
+
+    private:
+        constexpr writer_t& push(const packed_font_style_t style)
+        {
+            assert(m_style_depth < max_style_depth);
+            m_style_stack[m_style_depth++] = style;
+            write_style_change(m_style_stack[m_style_depth - 2], style);
+            return *this;
+        }
+
+        constexpr void write_style_change(const packed_font_style_t old_style, const packed_font_style_t new_style)
+        {
+            if (old_style != new_style)
+            {
+                sgr_encoder_t encoder{};
+                render_fn::change_style(encoder, old_style.unpack(), new_style.unpack());
+                write(encoder.view());
+            }
+        }
+
+        constexpr void write(std::string_view text)
+        {
+            for (const char ch : text)
+            {
+                if constexpr (Capacity > 0)
+                {
+                    m_data[m_size] = ch;
+                }
+                m_size += 1;
+            }
+        }
+    };
+
+    template <std::size_t Capacity, class Document>
+    static constexpr auto write(const Document& document) -> writer_t<Capacity>
+    {
+        writer_t<Capacity> writer{};
+        writer << document;
+        writer.finish();
+        return writer;
+    }
+
+    template <class Builder>
+    constexpr auto operator()(Builder builder) const
+    {
+        constexpr std::size_t size = write<0>(builder()).m_size;
+        return static_document_t<size>{ write<size>(builder()).m_data };
+    }
+} static_document{};
+
+}  // namespace ansi
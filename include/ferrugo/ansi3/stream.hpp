@@ -1,17 +1,26 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
 #include <cassert>
+#include <charconv>
 #include <cstdint>
 #include <cstdio>
+#include <ferrugo/ansi3/sanitize.hpp>
+#include <ferrugo/ansi3/sink.hpp>
+#include <ferrugo/color_quantizer.hpp>
+#include <ferrugo/sgr_encoder.hpp>
 #include <functional>
 #include <iostream>
 #include <iterator>
+#include <memory>
+#include <memory_resource>
 #include <optional>
 #include <sstream>
 #include <string>
 #include <string_view>
 #include <tuple>
+#include <utility>
 #include <variant>
 #include <vector>
 
@@ -27,284 +36,13 @@ struct remove_cvref
 template <class T>
 using remove_cvref_t = typename remove_cvref<T>::type;
 
-enum class basic_color_t
-{
-    black,
-    red,
-    green,
-    yellow,
-    blue,
-    magenta,
-    cyan,
-    white,
-};
-
-inline std::ostream& operator<<(std::ostream& os, basic_color_t item)
-{
-#define CASE(v) \
-    case basic_color_t::v: return os << #v
-    switch (item)
-    {
-        CASE(black);
-        CASE(red);
-        CASE(green);
-        CASE(yellow);
-        CASE(blue);
-        CASE(magenta);
-        CASE(cyan);
-        CASE(white);
-        default: throw std::runtime_error{ "unknown basic_color_t" };
-    }
-#undef CASE
-    return os;
-}
-
-struct default_color_t
-{
-    constexpr friend bool operator==(default_color_t, default_color_t)
-    {
-        return true;
-    }
-
-    constexpr friend bool operator!=(default_color_t, default_color_t)
-    {
-        return false;
-    }
-
-    friend std::ostream& operator<<(std::ostream& os, default_color_t)
-    {
-        return os << "default_color";
-    }
-};
-
-struct standard_color_t
-{
-    basic_color_t m_color;
-
-    constexpr explicit standard_color_t(basic_color_t color) : m_color(color)
-    {
-    }
-
-    constexpr friend bool operator==(const standard_color_t& lhs, const standard_color_t& rhs)
-    {
-        return lhs.m_color == rhs.m_color;
-    }
-
-    constexpr friend bool operator!=(const standard_color_t& lhs, const standard_color_t& rhs)
-    {
-        return !(lhs == rhs);
-    }
-
-    friend std::ostream& operator<<(std::ostream& os, const standard_color_t item)
-    {
-        return os << "{:standard_color " << item.m_color << "}";
-    }
-};
-
-struct bright_color_t
-{
-    basic_color_t m_color;
-
-    constexpr explicit bright_color_t(basic_color_t color) : m_color(color)
-    {
-    }
-
-    constexpr friend bool operator==(const bright_color_t& lhs, const bright_color_t& rhs)
-    {
-        return lhs.m_color == rhs.m_color;
-    }
-
-    constexpr friend bool operator!=(const bright_color_t& lhs, const bright_color_t& rhs)
-    {
-        return !(lhs == rhs);
-    }
-
-    friend std::ostream& operator<<(std::ostream& os, const bright_color_t item)
-    {
-        return os << "{:bright_color " << item.m_color << "}";
-    }
-};
-
-struct rgb_color_t : public std::array<std::uint8_t, 3>
-{
-    using base_t = std::array<std::uint8_t, 3>;
-    using base_t::base_t;
-
-    constexpr rgb_color_t(std::uint8_t r, std::uint8_t g, std::uint8_t b) : base_t{ { r, g, b } }
-    {
-    }
-
-    constexpr explicit rgb_color_t(std::string_view txt) : rgb_color_t{ 0, 0, 0 }
-    {
-        if (txt.front() == '#')
-        {
-            txt.remove_prefix(1);
-        }
-        assert(txt.size() == 6);
-        for (std::size_t i = 0; i < 3; ++i)
-        {
-            (*this)[i] = parse_sub(txt.substr(2 * i, 2));
-        }
-    }
-
-    friend std::ostream& operator<<(std::ostream& os, const rgb_color_t& item)
-    {
-        return os << "{:rgb_color ["  //
-                  << static_cast<int>(item[0]) << " " << static_cast<int>(item[1]) << " " << static_cast<int>(item[2])
-                  << "]}";
-    }
-
-private:
-    static std::uint8_t parse_sub(std::string_view str)
-    {
-        std::stringstream ss;
-        ss << std::hex << str;
-        std::int16_t result;
-        ss >> result;
-        return static_cast<std::uint8_t>(result);
-    }
-};
-
-struct palette_color_t
-{
-    std::uint8_t m_index;
-
-    constexpr explicit palette_color_t(std::uint8_t index) : m_index{ index }
-    {
-    }
-
-    constexpr explicit palette_color_t(standard_color_t col)
-        : palette_color_t{ static_cast<std::uint8_t>(static_cast<int>(col.m_color) + 0) }
-    {
-    }
-
-    constexpr explicit palette_color_t(bright_color_t col)
-        : palette_color_t{ static_cast<std::uint8_t>(static_cast<int>(col.m_color) + 8) }
-    {
-    }
-
-    constexpr explicit palette_color_t(basic_color_t col) : palette_color_t{ standard_color_t{ col } }
-    {
-    }
-
-    static palette_color_t from_rgb(const std::array<std::uint8_t, 3>& values)
-    {
-        std::uint8_t index = 0;
-        int e = 36;
-        for (std::size_t i = 0; i < 3; ++i)
-        {
-            assert(values[i] < 6);
-            index += e * values[i];
-            e /= 6;
-        }
-        return palette_color_t{ static_cast<std::uint8_t>(index + 16) };
-    }
-
-    static palette_color_t from_rgb(std::uint8_t r, std::uint8_t g, std::uint8_t b)
-    {
-        return from_rgb({ r, g, b });
-    }
-
-    static palette_color_t from_grayscale(std::uint8_t brightness)
-    {
-        assert(brightness < 24);
-        return palette_color_t{ static_cast<std::uint8_t>(brightness + 232) };
-    }
-
-    bool is_standard_color() const
-    {
-        return 0 <= m_index && m_index <= 7;
-    }
-
-    bool is_bright_color() const
-    {
-        return 8 <= m_index && m_index <= 15;
-    }
-
-    bool is_grayscale() const
-    {
-        return 232 <= m_index && m_index <= 255;
-    }
-
-    bool is_rgb() const
-    {
-        return 16 <= m_index && m_index <= 231;
-    }
-
-    friend bool operator==(const palette_color_t lhs, const palette_color_t rhs)
-    {
-        return lhs.m_index == rhs.m_index;
-    }
-
-    friend bool operator!=(const palette_color_t lhs, const palette_color_t rhs)
-    {
-        return !(lhs == rhs);
-    }
-
-    friend std::ostream& operator<<(std::ostream& os, const palette_color_t item)
-    {
-        return os << "{:palette_color " << static_cast<int>(item.m_index) << "}";
-    }
-};
-
-struct color_t
-{
-    using data_type = std::variant<default_color_t, standard_color_t, bright_color_t, palette_color_t, rgb_color_t>;
-
-    data_type m_data;
-
-    constexpr color_t() : m_data{ std::in_place_type<default_color_t>, default_color_t{} }
-    {
-    }
-
-    constexpr color_t(default_color_t col) : m_data{ std::in_place_type<default_color_t>, col }
-    {
-    }
-
-    constexpr color_t(standard_color_t col) : m_data{ std::in_place_type<standard_color_t>, col }
-    {
-    }
-
-    constexpr color_t(basic_color_t col) : color_t{ standard_color_t{ col } }
-    {
-    }
-
-    constexpr color_t(bright_color_t col) : m_data{ std::in_place_type<bright_color_t>, col }
-    {
-    }
-
-    constexpr color_t(palette_color_t col) : m_data{ std::in_place_type<palette_color_t>, col }
-    {
-    }
-
-    constexpr color_t(rgb_color_t col) : m_data{ std::in_place_type<rgb_color_t>, col }
-    {
-    }
-
-    constexpr color_t(std::string_view txt) : color_t{ rgb_color_t{ txt } }
-    {
-    }
-
-    constexpr color_t(const char* txt) : color_t{ std::string_view(txt) }
-    {
-    }
-
-    friend std::ostream& operator<<(std::ostream& os, const color_t& item)
-    {
-        std::visit([&](const auto& c) { os << c; }, item.m_data);
-        return os;
-    }
-
-    constexpr friend bool operator==(const color_t& lhs, const color_t& rhs)
-    {
-        return lhs.m_data == rhs.m_data;
-    }
-
-    constexpr friend bool operator!=(const color_t& lhs, const color_t& rhs)
-    {
-        return !(lhs == rhs);
-    }
-};
+using ferrugo::color::basic_color_t;
+using ferrugo::color::bright_color_t;
+using ferrugo::color::color_t;
+using ferrugo::color::default_color_t;
+using ferrugo::color::palette_color_t;
+using ferrugo::color::rgb_color_t;
+using ferrugo::color::standard_color_t;
 
 struct font_t
 {
@@ -405,17 +143,17 @@ struct font_t
     static const font_t crossed_out;
     static const font_t double_underline;
 
-    bool contains(font_t v) const
+    constexpr bool contains(font_t v) const
     {
         return static_cast<bool>(*this & v);
     }
 
-    font_t& unset(const font_t v)
+    constexpr font_t& unset(const font_t v)
     {
         return *this = *this & ~v;
     }
 
-    font_t& set(const font_t v)
+    constexpr font_t& set(const font_t v)
     {
         return *this = *this | v;
     }
@@ -455,17 +193,17 @@ struct font_t
     }
 };
 
-inline const font_t font_t::none{ 0 };
-inline const font_t font_t::standout{ 1 << 0 };
-inline const font_t font_t::bold{ 1 << 1 };
-inline const font_t font_t::dim{ 1 << 2 };
-inline const font_t font_t::italic{ 1 << 3 };
-inline const font_t font_t::underline{ 1 << 4 };
-inline const font_t font_t::blink{ 1 << 5 };
-inline const font_t font_t::inverse{ 1 << 6 };
-inline const font_t font_t::hidden{ 1 << 7 };
-inline const font_t font_t::crossed_out{ 1 << 8 };
-inline const font_t font_t::double_underline{ 1 << 9 };
+inline constexpr font_t font_t::none{ 0 };
+inline constexpr font_t font_t::standout{ 1 << 0 };
+inline constexpr font_t font_t::bold{ 1 << 1 };
+inline constexpr font_t font_t::dim{ 1 << 2 };
+inline constexpr font_t font_t::italic{ 1 << 3 };
+inline constexpr font_t font_t::underline{ 1 << 4 };
+inline constexpr font_t font_t::blink{ 1 << 5 };
+inline constexpr font_t font_t::inverse{ 1 << 6 };
+inline constexpr font_t font_t::hidden{ 1 << 7 };
+inline constexpr font_t font_t::crossed_out{ 1 << 8 };
+inline constexpr font_t font_t::double_underline{ 1 << 9 };
 
 struct font_style_t
 {
@@ -479,108 +217,470 @@ struct font_style_t
                   << ":foreground " << item.foreground << " :background " << item.background << " :font " << item.font
                   << "}";
     }
-};
 
-struct font_style_applier_t : public std::function<void(font_style_t&)>
-{
-    using base_t = std::function<void(font_style_t&)>;
+    constexpr friend bool operator==(const font_style_t& lhs, const font_style_t& rhs)
+    {
+        return lhs.foreground == rhs.foreground && lhs.background == rhs.background && lhs.font == rhs.font;
+    }
 
-    using base_t::base_t;
+    constexpr friend bool operator!=(const font_style_t& lhs, const font_style_t& rhs)
+    {
+        return !(lhs == rhs);
+    }
 };
 
-inline auto operator|(font_style_applier_t lhs, font_style_applier_t rhs) -> font_style_applier_t
+using ferrugo::color::color_depth_t;
+using ferrugo::color::color_quantizer_t;
+
+// ferrugo::color::downgrade, also applied to both colors of a font_style_t. Fonts are kept.
+constexpr inline struct downgrade_fn : ferrugo::color::downgrade_fn
 {
-    return [=](font_style_t& style)
-    {
-        lhs(style);
-        rhs(style);
-    };
-}
+    using ferrugo::color::downgrade_fn::operator();
 
-constexpr inline auto fg
-    = [](color_t col) -> font_style_applier_t { return [=](font_style_t& style) { style.foreground = col; }; };
+    font_style_t operator()(
+        const font_style_t& style,
+        color_depth_t depth,
+        const color_quantizer_t& quantizer = color_quantizer_t::default_instance()) const
+    {
+        return font_style_t{ (*this)(style.foreground, depth, quantizer),
+                             (*this)(style.background, depth, quantizer),
+                             style.font };
+    }
+} downgrade{};
 
-constexpr inline auto bg
-    = [](color_t col) -> font_style_applier_t { return [=](font_style_t& style) { style.background = col; }; };
+// Trivially copyable 64-bit encoding of font_style_t: each color takes 27 bits (3-bit tag, 24-bit payload),
+// followed by the ten named font flags. Font bits outside the named flags are dropped.
+struct packed_font_style_t
+{
+    using underlying_type = std::uint64_t;
 
-constexpr inline auto font
-    = [](font_t font) -> font_style_applier_t { return [=](font_style_t& style) { style.font |= font; }; };
+    static constexpr int color_bits = 27;
+    static constexpr underlying_type color_mask = (underlying_type(1) << color_bits) - 1;
+    static constexpr underlying_type font_mask = (underlying_type(1) << 10) - 1;
 
-enum class direction_t
-{
-    up,
-    down,
-    forward,
-    backward,
-    next_line,
-    prev_line,
-    column
-};
+    underlying_type m_value;
 
-inline std::ostream& operator<<(std::ostream& os, direction_t item)
-{
-#define CASE(v) \
-    case direction_t::v: return os << #v
-    switch (item)
+    constexpr packed_font_style_t() : m_value{ 0 }
     {
-        CASE(up);
-        CASE(down);
-        CASE(forward);
-        CASE(backward);
-        CASE(next_line);
-        CASE(prev_line);
-        CASE(column);
-        default: throw std::runtime_error{ "unknown direction_t" };
     }
-#undef CASE
-    return os;
-}
 
-enum class clear_screen_mode_t
-{
-    full,
-    to_end,
-    to_begin,
-    scrollback
-};
+    constexpr explicit packed_font_style_t(underlying_type value) : m_value{ value }
+    {
+    }
 
-inline std::ostream& operator<<(std::ostream& os, clear_screen_mode_t item)
-{
-#define CASE(v) \
-    case clear_screen_mode_t::v: return os << #v
-    switch (item)
+    constexpr explicit packed_font_style_t(const font_style_t& style)
+        : m_value{ pack(style.foreground) | (pack(style.background) << color_bits)
+                   | ((style.font.m_value & font_mask) << (2 * color_bits)) }
     {
-        CASE(full);
-        CASE(to_end);
-        CASE(to_begin);
-        CASE(scrollback);
-        default: throw std::runtime_error{ "unknown clear_screen_mode_t" };
     }
-#undef CASE
-    return os;
-}
 
-enum class clear_line_mode_t
-{
-    full,
-    to_end,
-    to_begin
-};
+    constexpr color_t foreground() const
+    {
+        return unpack(m_value & color_mask);
+    }
 
-inline std::ostream& operator<<(std::ostream& os, clear_line_mode_t item)
-{
-#define CASE(v) \
-    case clear_line_mode_t::v: return os << #v
-    switch (item)
+    constexpr color_t background() const
     {
-        CASE(full);
-        CASE(to_end);
-        CASE(to_begin);
-        default: throw std::runtime_error{ "unknown clear_line_mode_t" };
+        return unpack((m_value >> color_bits) & color_mask);
     }
-#undef CASE
-    return os;
-}
+
+    constexpr font_t font() const
+    {
+        return font_t{ static_cast<font_t::underlying_type>(m_value >> (2 * color_bits)) };
+    }
+
+    constexpr font_style_t unpack() const
+    {
+        return font_style_t{ foreground(), background(), font() };
+    }
+
+    constexpr explicit operator font_style_t() const
+    {
+        return unpack();
+    }
+
+    constexpr friend bool operator==(const packed_font_style_t lhs, const packed_font_style_t rhs)
+    {
+        return lhs.m_value == rhs.m_value;
+    }
+
+    constexpr friend bool operator!=(const packed_font_style_t lhs, const packed_font_style_t rhs)
+    {
+        return !(lhs == rhs);
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, const packed_font_style_t item)
+    {
+        return os << item.unpack();
+    }
+
+    static constexpr underlying_type pack(const color_t& col)
+    {
+        struct visitor_t
+        {
+            constexpr underlying_type operator()(default_color_t) const
+            {
+                return 0;
+            }
+
+            constexpr underlying_type operator()(standard_color_t c) const
+            {
+                return tag(1) | static_cast<underlying_type>(c.m_color);
+            }
+
+            constexpr underlying_type operator()(bright_color_t c) const
+            {
+                return tag(2) | static_cast<underlying_type>(c.m_color);
+            }
+
+            constexpr underlying_type operator()(palette_color_t c) const
+            {
+                return tag(3) | c.m_index;
+            }
+
+            constexpr underlying_type operator()(rgb_color_t c) const
+            {
+                return tag(4) | (underlying_type(c[0]) << 16) | (underlying_type(c[1]) << 8) | c[2];
+            }
+        };
+        return std::visit(visitor_t{}, col.m_data);
+    }
+
+    constexpr static color_t unpack(underlying_type value)
+    {
+        const auto payload = value & 0xFFFFFF;
+        switch (value >> 24)
+        {
+            case 1: return standard_color_t{ static_cast<basic_color_t>(payload) };
+            case 2: return bright_color_t{ static_cast<basic_color_t>(payload) };
+            case 3: return palette_color_t{ static_cast<std::uint8_t>(payload) };
+            case 4:
+                return rgb_color_t{ static_cast<std::uint8_t>(payload >> 16),
+                                    static_cast<std::uint8_t>(payload >> 8),
+                                    static_cast<std::uint8_t>(payload) };
+            default: return default_color_t{};
+        }
+    }
+
+private:
+    static constexpr underlying_type tag(underlying_type t)
+    {
+        return t << 24;
+    }
+};
+
+}  // namespace ansi
+
+namespace std
+{
+
+template <>
+struct hash<ansi::packed_font_style_t>
+{
+    std::size_t operator()(const ansi::packed_font_style_t item) const
+    {
+        std::uint64_t h = item.m_value;
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDull;
+        h ^= h >> 33;
+        return static_cast<std::size_t>(h);
+    }
+};
+
+template <>
+struct hash<ansi::font_style_t>
+{
+    std::size_t operator()(const ansi::font_style_t& item) const
+    {
+        return hash<ansi::packed_font_style_t>{}(ansi::packed_font_style_t{ item });
+    }
+};
+
+template <>
+struct hash<ansi::color_t>
+{
+    std::size_t operator()(const ansi::color_t& item) const
+    {
+        return hash<std::uint64_t>{}(ansi::packed_font_style_t::pack(item));
+    }
+};
+
+template <>
+struct hash<ansi::font_t>
+{
+    std::size_t operator()(const ansi::font_t item) const
+    {
+        return hash<ansi::font_t::underlying_type>{}(item.m_value);
+    }
+};
+
+}  // namespace std
+
+namespace ansi
+{
+
+// Value-type style modification. Applying it clears the m_clear font flags, sets the m_set font flags and replaces
+// the colors that are present. Colors are kept in their packed form (see packed_font_style_t), so a delta is
+// trivially copyable and hashable, and applying it to a packed style takes a few bit operations.
+struct style_delta_t
+{
+    using color_type = std::uint32_t;
+
+    static constexpr color_type no_color = ~color_type(0);
+
+    font_t m_set;
+    font_t m_clear;
+    color_type m_foreground;
+    color_type m_background;
+
+    constexpr style_delta_t() : m_set{}, m_clear{}, m_foreground{ no_color }, m_background{ no_color }
+    {
+    }
+
+    static constexpr style_delta_t with_foreground(const color_t& col)
+    {
+        style_delta_t result{};
+        result.m_foreground = static_cast<color_type>(packed_font_style_t::pack(col));
+        return result;
+    }
+
+    static constexpr style_delta_t with_background(const color_t& col)
+    {
+        style_delta_t result{};
+        result.m_background = static_cast<color_type>(packed_font_style_t::pack(col));
+        return result;
+    }
+
+    static constexpr style_delta_t with_font(font_t set, font_t clear = font_t{})
+    {
+        style_delta_t result{};
+        result.m_set = set;
+        result.m_clear = clear;
+        return result;
+    }
+
+    constexpr std::optional<color_t> foreground() const
+    {
+        return m_foreground != no_color ? std::optional<color_t>{ packed_font_style_t::unpack(m_foreground) }
+                                        : std::nullopt;
+    }
+
+    constexpr std::optional<color_t> background() const
+    {
+        return m_background != no_color ? std::optional<color_t>{ packed_font_style_t::unpack(m_background) }
+                                        : std::nullopt;
+    }
+
+    constexpr packed_font_style_t apply(const packed_font_style_t style) const
+    {
+        using underlying_type = packed_font_style_t::underlying_type;
+        constexpr int bits = packed_font_style_t::color_bits;
+        underlying_type value = style.m_value;
+        value &= ~(underlying_type(m_clear.m_value & packed_font_style_t::font_mask) << (2 * bits));
+        value |= underlying_type(m_set.m_value & packed_font_style_t::font_mask) << (2 * bits);
+        if (m_foreground != no_color)
+        {
+            value = (value & ~packed_font_style_t::color_mask) | m_foreground;
+        }
+        if (m_background != no_color)
+        {
+            value = (value & ~(packed_font_style_t::color_mask << bits)) | (underlying_type(m_background) << bits);
+        }
+        return packed_font_style_t{ value };
+    }
+
+    void operator()(font_style_t& style) const
+    {
+        style.font = (style.font & ~m_clear) | m_set;
+        if (m_foreground != no_color)
+        {
+            style.foreground = packed_font_style_t::unpack(m_foreground);
+        }
+        if (m_background != no_color)
+        {
+            style.background = packed_font_style_t::unpack(m_background);
+        }
+    }
+
+    // Applying lhs | rhs is equivalent to applying lhs, then rhs.
+    constexpr friend style_delta_t operator|(const style_delta_t& lhs, const style_delta_t& rhs)
+    {
+        style_delta_t result{};
+        result.m_set = (lhs.m_set & ~rhs.m_clear) | rhs.m_set;
+        result.m_clear = lhs.m_clear | rhs.m_clear;
+        result.m_foreground = rhs.m_foreground != no_color ? rhs.m_foreground : lhs.m_foreground;
+        result.m_background = rhs.m_background != no_color ? rhs.m_background : lhs.m_background;
+        return result;
+    }
+
+    constexpr friend style_delta_t& operator|=(style_delta_t& lhs, const style_delta_t& rhs)
+    {
+        return lhs = lhs | rhs;
+    }
+
+    constexpr friend bool operator==(const style_delta_t& lhs, const style_delta_t& rhs)
+    {
+        return lhs.m_set == rhs.m_set && lhs.m_clear == rhs.m_clear && lhs.m_foreground == rhs.m_foreground
+               && lhs.m_background == rhs.m_background;
+    }
+
+    constexpr friend bool operator!=(const style_delta_t& lhs, const style_delta_t& rhs)
+    {
+        return !(lhs == rhs);
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, const style_delta_t& item)
+    {
+        os << "{:set " << item.m_set << " :clear " << item.m_clear;
+        if (const auto col = item.foreground())
+        {
+            os << " :foreground " << *col;
+        }
+        if (const auto col = item.background())
+        {
+            os << " :background " << *col;
+        }
+        return os << "}";
+    }
+};
+
+}  // namespace ansi
+
+namespace std
+{
+
+template <>
+struct hash<ansi::style_delta_t>
+{
+    std::size_t operator()(const ansi::style_delta_t& item) const
+    {
+        const std::uint64_t fonts = (std::uint64_t(item.m_set.m_value) << 16) | item.m_clear.m_value;
+        const std::uint64_t colors = (std::uint64_t(item.m_foreground) << 32) | item.m_background;
+        return hash<ansi::packed_font_style_t>{}(ansi::packed_font_style_t{ colors ^ (fonts * 0x9E3779B97F4A7C15ull) });
+    }
+};
+
+}  // namespace std
+
+namespace ansi
+{
+
+// Arbitrary style modification; prefer style_delta_t, which does not allocate and can be compared and hashed.
+struct font_style_applier_t : public std::function<void(font_style_t&)>
+{
+    using base_t = std::function<void(font_style_t&)>;
+
+    using base_t::base_t;
+};
+
+inline auto operator|(font_style_applier_t lhs, font_style_applier_t rhs) -> font_style_applier_t
+{
+    return [=](font_style_t& style)
+    {
+        lhs(style);
+        rhs(style);
+    };
+}
+
+constexpr inline auto fg = [](color_t col) { return style_delta_t::with_foreground(col); };
+
+constexpr inline auto bg = [](color_t col) { return style_delta_t::with_background(col); };
+
+constexpr inline auto font = [](font_t font) { return style_delta_t::with_font(font); };
+
+constexpr inline auto bold = font(font_t::bold);
+constexpr inline auto italic = font(font_t::italic);
+constexpr inline auto underline = font(font_t::underline);
+constexpr inline auto dim = font(font_t::dim);
+constexpr inline auto inverse = font(font_t::inverse);
+constexpr inline auto crossed_out = font(font_t::crossed_out);
+constexpr inline auto blink = font(font_t::blink);
+constexpr inline auto hidden = font(font_t::hidden);
+
+constexpr inline auto black = fg(basic_color_t::black);
+constexpr inline auto red = fg(basic_color_t::red);
+constexpr inline auto green = fg(basic_color_t::green);
+constexpr inline auto yellow = fg(basic_color_t::yellow);
+constexpr inline auto blue = fg(basic_color_t::blue);
+constexpr inline auto magenta = fg(basic_color_t::magenta);
+constexpr inline auto cyan = fg(basic_color_t::cyan);
+constexpr inline auto white = fg(basic_color_t::white);
+
+enum class direction_t
+{
+    up,
+    down,
+    forward,
+    backward,
+    next_line,
+    prev_line,
+    column
+};
+
+inline std::ostream& operator<<(std::ostream& os, direction_t item)
+{
+#define CASE(v) \
+    case direction_t::v: return os << #v
+    switch (item)
+    {
+        CASE(up);
+        CASE(down);
+        CASE(forward);
+        CASE(backward);
+        CASE(next_line);
+        CASE(prev_line);
+        CASE(column);
+        default: throw std::runtime_error{ "unknown direction_t" };
+    }
+#undef CASE
+    return os;
+}
+
+enum class clear_screen_mode_t
+{
+    full,
+    to_end,
+    to_begin,
+    scrollback
+};
+
+inline std::ostream& operator<<(std::ostream& os, clear_screen_mode_t item)
+{
+#define CASE(v) \
+    case clear_screen_mode_t::v: return os << #v
+    switch (item)
+    {
+        CASE(full);
+        CASE(to_end);
+        CASE(to_begin);
+        CASE(scrollback);
+        default: throw std::runtime_error{ "unknown clear_screen_mode_t" };
+    }
+#undef CASE
+    return os;
+}
+
+enum class clear_line_mode_t
+{
+    full,
+    to_end,
+    to_begin
+};
+
+inline std::ostream& operator<<(std::ostream& os, clear_line_mode_t item)
+{
+#define CASE(v) \
+    case clear_line_mode_t::v: return os << #v
+    switch (item)
+    {
+        CASE(full);
+        CASE(to_end);
+        CASE(to_begin);
+        default: throw std::runtime_error{ "unknown clear_line_mode_t" };
+    }
+#undef CASE
+    return os;
+}
 
 struct op_new_line_t
 {
@@ -596,7 +696,7 @@ struct op_unindent_t
 
 struct op_text_t
 {
-    std::string content;
+    std::pmr::string content;
 };
 
 struct op_text_ref_t
@@ -610,6 +710,11 @@ struct op_push_style_t
 };
 
 struct op_modify_style_t
+{
+    style_delta_t delta;
+};
+
+struct op_apply_style_t
 {
     font_style_applier_t applier;
 };
@@ -618,6 +723,12 @@ struct op_pop_style_t
 {
 };
 
+// Not part of stream_op_t; emitted by op sources that keep their styles packed, e.g. compact_stream_t.
+struct op_push_packed_style_t
+{
+    packed_font_style_t style;
+};
+
 struct op_move_cursor
 {
     direction_t direction;
@@ -645,7 +756,13 @@ struct op_set_cursor_visibility
     bool value;
 };
 
-inline std::ostream& operator<<(std::ostream& os, const op_new_line_t& item)
+// A hole filled in when a compiled render_plan_t is rendered; renders as empty text otherwise.
+struct op_placeholder_t
+{
+    std::size_t index;
+};
+
+inline std::ostream& operator<<(std::ostream& os, const op_new_line_t& item)
 {
     return os << "{:new_line}";
 }
@@ -676,6 +793,11 @@ inline std::ostream& operator<<(std::ostream& os, const op_push_style_t& item)
 }
 
 inline std::ostream& operator<<(std::ostream& os, const op_modify_style_t& item)
+{
+    return os << "{:modify_style " << item.delta << "}";
+}
+
+inline std::ostream& operator<<(std::ostream& os, const op_apply_style_t& item)
 {
     return os << "{:modify_style <applier>}";
 }
@@ -685,6 +807,11 @@ inline std::ostream& operator<<(std::ostream& os, const op_pop_style_t& item)
     return os << "{:pop_style}";
 }
 
+inline std::ostream& operator<<(std::ostream& os, const op_push_packed_style_t& item)
+{
+    return os << "{:push_style " << item.style << "}";
+}
+
 inline std::ostream& operator<<(std::ostream& os, const op_move_cursor& item)
 {
     return os << "{:move_cursor " << item.direction << " " << item.value << "}";
@@ -710,6 +837,11 @@ inline std::ostream& operator<<(std::ostream& os, const op_set_cursor_visibility
     return os << "{:set_cursor_visibility " << (item.value ? "true" : "false") << "}";
 }
 
+inline std::ostream& operator<<(std::ostream& os, const op_placeholder_t& item)
+{
+    return os << "{:placeholder " << item.index << "}";
+}
+
 using stream_op_t = std::variant<  //
     op_new_line_t,
     op_indent_t,
@@ -718,12 +850,14 @@ using stream_op_t = std::variant<  //
     op_text_ref_t,
     op_push_style_t,
     op_modify_style_t,
+    op_apply_style_t,
     op_pop_style_t,
     op_move_cursor,
     op_move_cursor_to,
     op_clear_screen,
     op_clear_line,
-    op_set_cursor_visibility>;
+    op_set_cursor_visibility,
+    op_placeholder_t>;
 
 inline std::ostream& operator<<(std::ostream& os, const stream_op_t& item)
 {
@@ -731,189 +865,1165 @@ inline std::ostream& operator<<(std::ostream& os, const stream_op_t& item)
     return os;
 }
 
-template <class T, class = void>
-struct formatter_t;
+template <class T, class = void>
+struct formatter_t;
+
+constexpr inline auto new_line = op_new_line_t{};
+
+constexpr inline auto indent = op_indent_t{};
+
+constexpr inline auto unindent = op_unindent_t{};
+
+constexpr inline auto text = [](std::string_view content, std::pmr::polymorphic_allocator<char> alloc = {})
+{ return op_text_t{ std::pmr::string{ content, alloc } }; };
+
+constexpr inline auto text_ref = [](std::string_view content) { return op_text_ref_t{ content }; };
+
+constexpr inline auto push_style = [](font_style_t style) { return op_push_style_t{ std::move(style) }; };
+constexpr inline struct modify_style_fn
+{
+    constexpr auto operator()(style_delta_t delta) const -> op_modify_style_t
+    {
+        return op_modify_style_t{ delta };
+    }
+
+    auto operator()(font_style_applier_t applier) const -> op_apply_style_t
+    {
+        return op_apply_style_t{ std::move(applier) };
+    }
+} modify_style{};
+
+constexpr inline auto pop_style = op_pop_style_t{};
+
+constexpr inline auto move_cursor = [](direction_t direction, int value) { return op_move_cursor{ direction, value }; };
+constexpr inline auto move_cursor_to = [](int row = 1, int column = 1) { return op_move_cursor_to{ row, column }; };
+
+constexpr inline auto clear_screen
+    = [](clear_screen_mode_t mode = clear_screen_mode_t::full) { return op_clear_screen{ mode }; };
+constexpr inline auto clear_line = [](clear_line_mode_t mode = clear_line_mode_t::full) { return op_clear_line{ mode }; };
+
+constexpr inline auto set_cursor_visibility = [](bool value) { return op_set_cursor_visibility{ value }; };
+
+constexpr inline auto placeholder = [](std::size_t index) { return op_placeholder_t{ index }; };
+
+// Ops appended to a stream are stored in m_ops. A child stream appended by rvalue is spliced in as a chunk in O(1)
+// instead of having its ops moved, so that nested builders do not copy their content once per nesting level.
+// m_chunks[i] is logically located before m_ops[m_chunk_positions[i]]. Small children without chunks of their own are
+// still merged into m_ops, which keeps each op moved a bounded number of times. visit() walks the ops in order;
+// flatten() merges the chunks back into m_ops.
+//
+// Storage, including the content of op_text_t, comes from the stream's memory resource. Text appended from another
+// resource is copied, so a stream never refers to memory it does not own.
+struct stream_t
+{
+    using allocator_type = std::pmr::polymorphic_allocator<std::byte>;
+
+    static constexpr std::size_t splice_threshold = 32;
+
+    std::pmr::vector<stream_op_t> m_ops;
+    std::pmr::vector<stream_t> m_chunks;
+    std::pmr::vector<std::size_t> m_chunk_positions;
+
+    stream_t() = default;
+    stream_t(const stream_t&) = default;
+    stream_t(stream_t&&) noexcept = default;
+    stream_t& operator=(const stream_t&) = default;
+    stream_t& operator=(stream_t&&) = default;
+
+    explicit stream_t(const allocator_type& alloc) : m_ops{ alloc }, m_chunks{ alloc }, m_chunk_positions{ alloc }
+    {
+    }
+
+    stream_t(const stream_t& other, const allocator_type& alloc) : stream_t{ alloc }
+    {
+        *this << other;
+    }
+
+    stream_t(stream_t&& other, const allocator_type& alloc) : stream_t{ alloc }
+    {
+        *this << std::move(other);
+    }
+
+    allocator_type get_allocator() const
+    {
+        return m_ops.get_allocator();
+    }
+
+    // Total number of ops, including the ones in chunks.
+    std::size_t size() const
+    {
+        std::size_t result = m_ops.size();
+        for (const stream_t& chunk : m_chunks)
+        {
+            result += chunk.size();
+        }
+        return result;
+    }
+
+    bool empty() const
+    {
+        return m_ops.empty() && m_chunks.empty();
+    }
+
+    // Removes all ops. The op storage keeps its capacity, so rebuilding a stream of similar size does not reallocate.
+    void clear()
+    {
+        m_ops.clear();
+        m_chunks.clear();
+        m_chunk_positions.clear();
+    }
+
+    stream_t& operator<<(const stream_t& other)
+    {
+        m_ops.reserve(m_ops.size() + other.size());
+        other.visit([&](const auto& op) { *this << op; });
+        return *this;
+    }
+
+    stream_t& operator<<(stream_t& other)
+    {
+        return *this << static_cast<const stream_t&>(other);
+    }
+
+    stream_t& operator<<(stream_t&& other)
+    {
+        if (other.get_allocator() != get_allocator())
+        {
+            *this << static_cast<const stream_t&>(other);
+        }
+        else if (empty())
+        {
+            *this = std::move(other);
+        }
+        else if (other.m_chunks.empty() && other.m_ops.size() <= splice_threshold)
+        {
+            m_ops.insert(
+                m_ops.end(), std::make_move_iterator(other.m_ops.begin()), std::make_move_iterator(other.m_ops.end()));
+        }
+        else if (!other.empty())
+        {
+            m_chunk_positions.push_back(m_ops.size());
+            m_chunks.push_back(std::move(other));
+        }
+        return *this;
+    }
+
+    template <class T>
+    stream_t& operator<<(T&& item)
+    {
+        if constexpr (std::is_same_v<remove_cvref_t<T>, op_text_t> || std::is_same_v<remove_cvref_t<T>, stream_op_t>)
+        {
+            push(std::forward<T>(item));
+        }
+        else if constexpr (std::is_constructible_v<stream_op_t, T>)
+        {
+            m_ops.push_back(std::forward<T>(item));
+        }
+        else if constexpr (std::is_invocable_v<T, stream_t&>)
+        {
+            std::invoke(std::forward<T>(item), *this);
+        }
+        else
+        {
+            formatter_t<remove_cvref_t<T>>{}.format(*this, std::forward<T>(item));
+        }
+        return *this;
+    }
+
+    template <class... Args>
+    stream_t& operator()(Args&&... args) &
+    {
+        (*this << ... << std::forward<Args>(args));
+        return *this;
+    }
+
+    // Lets `return stream_t{}(...)` move the result instead of copying it.
+    template <class... Args>
+    stream_t&& operator()(Args&&... args) &&
+    {
+        (*this << ... << std::forward<Args>(args));
+        return std::move(*this);
+    }
+
+    // Calls the visitor with each op in order, descending into chunks.
+    template <class Visitor>
+    void visit(Visitor&& visitor) const
+    {
+        std::size_t chunk = 0;
+        for (std::size_t i = 0; i < m_ops.size(); ++i)
+        {
+            for (; chunk < m_chunks.size() && m_chunk_positions[chunk] == i; ++chunk)
+            {
+                m_chunks[chunk].visit(visitor);
+            }
+            std::visit(visitor, m_ops[i]);
+        }
+        for (; chunk < m_chunks.size(); ++chunk)
+        {
+            m_chunks[chunk].visit(visitor);
+        }
+    }
+
+    void flatten()
+    {
+        if (m_chunks.empty())
+        {
+            return;
+        }
+        std::pmr::vector<stream_op_t> ops{ m_ops.get_allocator() };
+        ops.reserve(size());
+        move_ops_to(ops);
+        m_ops = std::move(ops);
+        m_chunks.clear();
+        m_chunk_positions.clear();
+    }
+
+private:
+    void push(const op_text_t& op)
+    {
+        m_ops.push_back(op_text_t{ std::pmr::string{ op.content, m_ops.get_allocator() } });
+    }
+
+    void push(op_text_t&& op)
+    {
+        if (op.content.get_allocator() == m_ops.get_allocator())
+        {
+            m_ops.push_back(std::move(op));
+        }
+        else
+        {
+            push(static_cast<const op_text_t&>(op));
+        }
+    }
+
+    void push(const stream_op_t& op)
+    {
+        if (const op_text_t* text = std::get_if<op_text_t>(&op))
+        {
+            push(*text);
+            return;
+        }
+        m_ops.push_back(op);
+    }
+
+    void push(stream_op_t&& op)
+    {
+        if (op_text_t* text = std::get_if<op_text_t>(&op))
+        {
+            push(std::move(*text));
+            return;
+        }
+        m_ops.push_back(std::move(op));
+    }
+
+    void move_ops_to(std::pmr::vector<stream_op_t>& out)
+    {
+        std::size_t chunk = 0;
+        for (std::size_t i = 0; i < m_ops.size(); ++i)
+        {
+            for (; chunk < m_chunks.size() && m_chunk_positions[chunk] == i; ++chunk)
+            {
+                m_chunks[chunk].move_ops_to(out);
+            }
+            out.push_back(std::move(m_ops[i]));
+        }
+        for (; chunk < m_chunks.size(); ++chunk)
+        {
+            m_chunks[chunk].move_ops_to(out);
+        }
+    }
+};
+
+template <class... Args>
+stream_t& format_to(stream_t& stream, Args&&... args)
+{
+    return stream(std::forward<Args>(args)...);
+}
+
+template <class... Args>
+stream_t format(Args&&... args)
+{
+    stream_t stream;
+    format_to(stream, std::forward<Args>(args)...);
+    return stream;
+}
+
+template <class... Args>
+stream_t format(std::allocator_arg_t, const stream_t::allocator_type& alloc, Args&&... args)
+{
+    stream_t stream{ alloc };
+    format_to(stream, std::forward<Args>(args)...);
+    return stream;
+}
+
+// Peephole pass over stream ops. Adjacent op_text_t ops are merged into one, indent directly followed by
+// unindent is dropped, and a push_style / modify_style directly followed by pop_style is dropped when it does not
+// change the style in effect. The style in effect is simulated from the default style, so the result renders
+// byte-identically when rendered on its own. Text refs are kept as they are: merging them would copy text the renderer
+// writes without copying.
+constexpr inline struct optimize_fn
+{
+    // Text and the style bookkeeping are allocated from the memory resource of the output.
+    struct optimizer_t
+    {
+        std::pmr::vector<stream_op_t>& m_out;
+        std::pmr::vector<packed_font_style_t> m_styles;
+        std::pmr::vector<bool> m_style_changed;
+
+        explicit optimizer_t(std::pmr::vector<stream_op_t>& out)
+            : m_out{ out }
+            , m_styles{ { packed_font_style_t{} }, out.get_allocator() }
+            , m_style_changed{ out.get_allocator() }
+        {
+        }
+
+        void operator()(stream_op_t op)
+        {
+            std::visit([&](auto& v) { append(std::move(v)); }, op);
+        }
+
+        template <class Op>
+        void operator()(const Op& v)
+        {
+            append(v);
+        }
+
+        void operator()(const op_text_t& v)
+        {
+            if (op_text_t* prev = back_as_text())
+            {
+                prev->content += v.content;
+                return;
+            }
+            m_out.push_back(op_text_t{ std::pmr::string{ v.content, m_out.get_allocator().resource() } });
+        }
+
+        void append(op_text_t v)
+        {
+            if (op_text_t* prev = back_as_text())
+            {
+                prev->content += v.content;
+                return;
+            }
+            if (v.content.get_allocator() != m_out.get_allocator())
+            {
+                (*this)(static_cast<const op_text_t&>(v));
+                return;
+            }
+            m_out.push_back(std::move(v));
+        }
+
+        void append(op_unindent_t v)
+        {
+            if (!m_out.empty() && std::holds_alternative<op_indent_t>(m_out.back()))
+            {
+                m_out.pop_back();
+                return;
+            }
+            m_out.push_back(v);
+        }
+
+        void append(op_push_style_t v)
+        {
+            push(packed_font_style_t{ v.style });
+            m_out.push_back(std::move(v));
+        }
+
+        void append(op_modify_style_t v)
+        {
+            push(v.delta.apply(m_styles.back()));
+            m_out.push_back(v);
+        }
+
+        void append(op_apply_style_t v)
+        {
+            font_style_t style = m_styles.back().unpack();
+            v.applier(style);
+            push(packed_font_style_t{ style });
+            m_out.push_back(std::move(v));
+        }
+
+        void append(op_pop_style_t v)
+        {
+            if (m_styles.size() < 2)
+            {
+                m_out.push_back(v);
+                return;
+            }
+            const bool changed = m_style_changed.back();
+            m_styles.pop_back();
+            m_style_changed.pop_back();
+            if (!changed && !m_out.empty()
+                && (std::holds_alternative<op_push_style_t>(m_out.back())
+                    || std::holds_alternative<op_modify_style_t>(m_out.back())
+                    || std::holds_alternative<op_apply_style_t>(m_out.back())))
+            {
+                m_out.pop_back();
+                return;
+            }
+            m_out.push_back(v);
+        }
+
+        template <class Op>
+        void append(Op v)
+        {
+            m_out.push_back(std::move(v));
+        }
+
+    private:
+        void push(packed_font_style_t style)
+        {
+            m_style_changed.push_back(style != m_styles.back());
+            m_styles.push_back(style);
+        }
+
+        op_text_t* back_as_text()
+        {
+            return m_out.empty() ? nullptr : std::get_if<op_text_t>(&m_out.back());
+        }
+    };
+
+    void operator()(const stream_t& stream, std::pmr::vector<stream_op_t>& out) const
+    {
+        stream.visit(optimizer_t{ out });
+    }
+
+    // Returns the number of removed ops.
+    auto operator()(stream_t& stream) const -> std::size_t
+    {
+        stream.flatten();
+        const std::size_t size = stream.m_ops.size();
+        std::pmr::vector<stream_op_t> out{ stream.m_ops.get_allocator() };
+        out.reserve(size);
+        optimizer_t optimizer{ out };
+        for (stream_op_t& op : stream.m_ops)
+        {
+            optimizer(std::move(op));
+        }
+        stream.m_ops = std::move(out);
+        return size - stream.m_ops.size();
+    }
+} optimize{};
+
+using sgr_encoder_t = ferrugo::sgr::encoder_t;
+
+struct render_fn
+{
+    template <int Base>
+    struct color_visitor_t
+    {
+        sgr_encoder_t& m_encoder;
+
+        constexpr void operator()(default_color_t) const
+        {
+            m_encoder.arg(Base + 39);
+        }
+
+        constexpr void operator()(standard_color_t col) const
+        {
+            m_encoder.arg(Base + 30 + static_cast<int>(col.m_color));
+        }
+
+        constexpr void operator()(bright_color_t col) const
+        {
+            m_encoder.arg(Base + 90 + static_cast<int>(col.m_color));
+        }
+
+        constexpr void operator()(palette_color_t col) const
+        {
+            m_encoder.arg(Base + 38).arg(5).arg(col.m_index);
+        }
+
+        constexpr void operator()(rgb_color_t col) const
+        {
+            m_encoder.arg(Base + 38).arg(2).arg(col[0]).arg(col[1]).arg(col[2]);
+        }
+    };
+
+    static constexpr std::array<std::pair<font_t, std::uint8_t>, 9> font_codes = { {
+        { font_t::bold, 1 },      { font_t::dim, 2 },         { font_t::italic, 3 },
+        { font_t::underline, 4 }, { font_t::blink, 5 },       { font_t::inverse, 7 },
+        { font_t::hidden, 8 },    { font_t::crossed_out, 9 }, { font_t::double_underline, 21 },
+    } };
+
+    static constexpr void change_style(
+        sgr_encoder_t& encoder, const font_style_t& old_style, const font_style_t& new_style)
+    {
+        if (old_style.foreground != new_style.foreground)
+        {
+            encoder.begin();
+            std::visit(color_visitor_t<0>{ encoder }, new_style.foreground.m_data);
+            encoder.end();
+        }
+        if (old_style.background != new_style.background)
+        {
+            encoder.begin();
+            std::visit(color_visitor_t<10>{ encoder }, new_style.background.m_data);
+            encoder.end();
+        }
+        if (old_style.font != new_style.font)
+        {
+            encoder.begin().arg(22).arg(23).arg(24).arg(25).arg(27).arg(28).arg(29);
+            for (const auto& [f, v] : font_codes)
+            {
+                if (new_style.font.contains(f))
+                {
+                    encoder.arg(v);
+                }
+            }
+            encoder.end();
+        }
+    }
+
+    static std::string change_style(const font_style_t& old_style, const font_style_t& new_style)
+    {
+        sgr_encoder_t encoder;
+        change_style(encoder, old_style, new_style);
+        return std::string{ encoder.view() };
+    }
+
+    // Bounded, direct-mapped cache of encoded style transitions. A slot is overwritten when another transition
+    // hashes to it. Use thread_local_instance() to share one cache between renders on the same thread.
+    struct style_transition_cache_t
+    {
+        struct entry_t
+        {
+            packed_font_style_t m_old_style = {};
+            packed_font_style_t m_new_style = {};
+            bool m_occupied = false;
+            std::uint8_t m_size = 0;
+            std::array<char, sgr_encoder_t::capacity> m_data = {};
+        };
+
+        std::size_t m_capacity;
+        std::vector<entry_t> m_entries;
+        std::size_t m_hits = 0;
+        std::size_t m_misses = 0;
+        color_depth_t m_color_depth;
+        const color_quantizer_t* m_quantizer = nullptr;
+
+        explicit style_transition_cache_t(
+            std::size_t capacity = 256, color_depth_t color_depth = color_depth_t::truecolor)
+            : m_capacity{ std::max<std::size_t>(capacity, 1) }
+            , m_color_depth{ color_depth }
+        {
+        }
+
+        static style_transition_cache_t& thread_local_instance()
+        {
+            static thread_local style_transition_cache_t instance;
+            return instance;
+        }
+
+        std::string_view get(const packed_font_style_t old_style, const packed_font_style_t new_style)
+        {
+            if (m_entries.empty())
+            {
+                m_entries.resize(m_capacity);
+            }
+
+            entry_t& entry = m_entries[index(old_style, new_style)];
+            if (entry.m_occupied && entry.m_old_style == old_style && entry.m_new_style == new_style)
+            {
+                m_hits += 1;
+                return { entry.m_data.data(), entry.m_size };
+            }
+
+            m_misses += 1;
+            sgr_encoder_t encoder;
+            if (m_color_depth == color_depth_t::truecolor)
+            {
+                change_style(encoder, old_style.unpack(), new_style.unpack());
+            }
+            else
+            {
+                const color_quantizer_t& quantizer
+                    = m_quantizer != nullptr ? *m_quantizer : color_quantizer_t::default_instance();
+                change_style(
+                    encoder,
+                    downgrade(old_style.unpack(), m_color_depth, quantizer),
+                    downgrade(new_style.unpack(), m_color_depth, quantizer));
+            }
+            entry.m_old_style = old_style;
+            entry.m_new_style = new_style;
+            entry.m_occupied = true;
+            entry.m_size = static_cast<std::uint8_t>(encoder.size());
+            std::copy(encoder.data(), encoder.data() + encoder.size(), entry.m_data.data());
+            return { entry.m_data.data(), entry.m_size };
+        }
+
+        void clear()
+        {
+            m_entries.clear();
+            m_hits = 0;
+            m_misses = 0;
+        }
+
+        // Colors are downgraded to the depth when a transition is encoded, using the quantizer (or the default one
+        // when null), which must outlive the cache. Changing either drops the cached entries.
+        void set_color_depth(color_depth_t color_depth, const color_quantizer_t* quantizer = nullptr)
+        {
+            if (color_depth != m_color_depth || quantizer != m_quantizer)
+            {
+                m_entries.clear();
+                m_color_depth = color_depth;
+                m_quantizer = quantizer;
+            }
+        }
+
+    private:
+        std::size_t index(const packed_font_style_t old_style, const packed_font_style_t new_style) const
+        {
+            std::size_t h = std::hash<packed_font_style_t>{}(old_style);
+            h ^= std::hash<packed_font_style_t>{}(new_style) + 0x9E3779B97F4A7C15ull + (h << 6) + (h >> 2);
+            return h % m_capacity;
+        }
+    };
+
+    struct indent_guide_t
+    {
+        std::string text;
+        font_style_t style;
+    };
+
+    // Encoded line prefixes per nesting depth. Level i is drawn with guide min(i, guides.size() - 1), in its style;
+    // the prefix ends in the default style. Prefixes are built the first time a depth is reached, so writing one
+    // is a single write without allocation.
+    struct indent_prefix_cache_t
+    {
+        std::vector<indent_guide_t> m_guides;
+        std::vector<std::string> m_prefixes;
+        std::vector<std::string> m_plain_prefixes;
+
+        explicit indent_prefix_cache_t(std::vector<indent_guide_t> guides = { indent_guide_t{ "  ", font_style_t{} } })
+            : m_guides{ std::move(guides) }
+            , m_prefixes{}
+            , m_plain_prefixes{}
+        {
+            if (m_guides.empty())
+            {
+                m_guides.push_back(indent_guide_t{});
+            }
+        }
+
+        // Shared cache using the default guide of two spaces per level.
+        static indent_prefix_cache_t& thread_local_instance()
+        {
+            static thread_local indent_prefix_cache_t instance;
+            return instance;
+        }
+
+        std::string_view get(std::size_t depth)
+        {
+            while (m_prefixes.size() <= depth)
+            {
+                m_prefixes.push_back(build(m_prefixes.size()));
+            }
+            return m_prefixes[depth];
+        }
+
+        // The prefix without escape sequences.
+        std::string_view get_plain(std::size_t depth)
+        {
+            while (m_plain_prefixes.size() <= depth)
+            {
+                const std::size_t level = m_plain_prefixes.size();
+                m_plain_prefixes.push_back(
+                    level == 0 ? std::string{}
+                               : m_plain_prefixes.back() + m_guides[std::min(level - 1, m_guides.size() - 1)].text);
+            }
+            return m_plain_prefixes[depth];
+        }
+
+    private:
+        std::string build(std::size_t depth) const
+        {
+            std::string result;
+            sgr_encoder_t encoder;
+            font_style_t current_style = {};
+            for (std::size_t level = 0; level < depth; ++level)
+            {
+                const indent_guide_t& guide = m_guides[std::min(level, m_guides.size() - 1)];
+                encoder.clear();
+                change_style(encoder, current_style, guide.style);
+                result.append(encoder.data(), encoder.size());
+                result += guide.text;
+                current_style = guide.style;
+            }
+            encoder.clear();
+            change_style(encoder, current_style, font_style_t{});
+            result.append(encoder.data(), encoder.size());
+            return result;
+        }
+    };
+
+    template <class Sink>
+    struct context_t
+    {
+        Sink sink;
+        int indent_level = 0;
+        bool new_line = false;
+        std::vector<packed_font_style_t> style_stack = { packed_font_style_t{} };
+        style_transition_cache_t* cache = nullptr;
+        indent_prefix_cache_t* prefixes = nullptr;
+        sanitize_mode_t sanitize = sanitize_mode_t::none;
+    };
+
+    template <class Sink>
+    struct visitor_t
+    {
+        context_t<Sink>& m_ctx;
+
+        void operator()(op_new_line_t) const
+        {
+            m_ctx.new_line = true;
+        }
+
+        void operator()(op_indent_t) const
+        {
+            m_ctx.indent_level += 1;
+        }
+
+        void operator()(op_unindent_t) const
+        {
+            m_ctx.indent_level = std::max(0, m_ctx.indent_level - 1);
+        }
+
+        void operator()(const op_text_t& v) const
+        {
+            handle_indent();
+            write_text(v.content);
+        }
+
+        void operator()(const op_text_ref_t& v) const
+        {
+            handle_indent();
+            write_text(v.content);
+        }
+
+        void operator()(const op_push_style_t& v) const
+        {
+            (*this)(op_push_packed_style_t{ packed_font_style_t{ v.style } });
+        }
+
+        void operator()(const op_push_packed_style_t& v) const
+        {
+            const packed_font_style_t previous_style = m_ctx.style_stack.back();
+            m_ctx.style_stack.push_back(v.style);
+            write_style_change(previous_style, m_ctx.style_stack.back());
+        }
+
+        void operator()(const op_modify_style_t& v) const
+        {
+            const packed_font_style_t previous_style = m_ctx.style_stack.back();
+            m_ctx.style_stack.push_back(v.delta.apply(previous_style));
+            write_style_change(previous_style, m_ctx.style_stack.back());
+        }
+
+        void operator()(const op_apply_style_t& v) const
+        {
+            const packed_font_style_t previous_style = m_ctx.style_stack.back();
+            font_style_t new_style = previous_style.unpack();
+            v.applier(new_style);
+            m_ctx.style_stack.push_back(packed_font_style_t{ new_style });
+            write_style_change(previous_style, m_ctx.style_stack.back());
+        }
+
+        void operator()(op_pop_style_t) const
+        {
+            const packed_font_style_t previous_style = m_ctx.style_stack.back();
+            m_ctx.style_stack.pop_back();
+            write_style_change(previous_style, m_ctx.style_stack.back());
+        }
+
+        void operator()(const op_move_cursor& v) const
+        {
+            switch (v.direction)
+            {
+                case direction_t::up: write_csi(v.value, 'A'); break;
+                case direction_t::down: write_csi(v.value, 'B'); break;
+                case direction_t::forward: write_csi(v.value, 'C'); break;
+                case direction_t::backward: write_csi(v.value, 'D'); break;
+                case direction_t::next_line: write_csi(v.value, 'E'); break;
+                case direction_t::prev_line: write_csi(v.value, 'F'); break;
+                case direction_t::column: write_csi(v.value, 'G'); break;
+                default: break;
+            }
+        }
+
+        void operator()(const op_move_cursor_to& v) const
+        {
+            char buffer[32] = { '\033', '[' };
+            char* ptr = std::to_chars(buffer + 2, buffer + 13, v.row).ptr;
+            *ptr++ = ';';
+            ptr = std::to_chars(ptr, ptr + 11, v.column).ptr;
+            *ptr++ = 'H';
+            m_ctx.sink.append(buffer, static_cast<std::size_t>(ptr - buffer));
+        }
+
+        void operator()(const op_clear_screen& v) const
+        {
+            switch (v.mode)
+            {
+                case clear_screen_mode_t::to_end: write("\033[0J"); break;
+                case clear_screen_mode_t::to_begin: write("\033[1J"); break;
+                case clear_screen_mode_t::full: write("\033[2J"); break;
+                case clear_screen_mode_t::scrollback: write("\033[3J"); break;
+                default: break;
+            }
+        }
+
+        void operator()(const op_clear_line& v) const
+        {
+            switch (v.mode)
+            {
+                case clear_line_mode_t::to_end: write("\033[0K"); break;
+                case clear_line_mode_t::to_begin: write("\033[1K"); break;
+                case clear_line_mode_t::full: write("\033[2K"); break;
+                default: break;
+            }
+        }
+
+        void operator()(const op_set_cursor_visibility& v) const
+        {
+            write(v.value ? "\033[?25h" : "\033[?25l");
+        }
+
+        void operator()(op_placeholder_t) const
+        {
+            handle_indent();
+        }
+
+        void write(std::string_view text) const
+        {
+            m_ctx.sink.append(text.data(), text.size());
+        }
+
+        void write_text(std::string_view text) const
+        {
+            if (m_ctx.sanitize != sanitize_mode_t::none)
+            {
+                ansi::sanitize(m_ctx.sink, text, m_ctx.sanitize);
+            }
+            else if constexpr (has_append_ref_v<std::remove_reference_t<Sink>>)
+            {
+                m_ctx.sink.append_ref(text.data(), text.size());
+            }
+            else
+            {
+                write(text);
+            }
+        }
+
+        void write_csi(int value, char final_byte) const
+        {
+            char buffer[16] = { '\033', '[' };
+            char* ptr = std::to_chars(buffer + 2, buffer + 13, value).ptr;
+            *ptr++ = final_byte;
+            m_ctx.sink.append(buffer, static_cast<std::size_t>(ptr - buffer));
+        }
 
-constexpr inline auto new_line = op_new_line_t{};
+        void write_style_change(const packed_font_style_t old_style, const packed_font_style_t new_style) const
+        {
+            if (old_style == new_style)
+            {
+                return;
+            }
+            write(m_ctx.cache->get(old_style, new_style));
+        }
 
-constexpr inline auto indent = op_indent_t{};
+        void handle_indent() const
+        {
+            if (m_ctx.new_line)
+            {
+                write_line_break(static_cast<std::size_t>(m_ctx.indent_level), m_ctx.style_stack.back());
+                m_ctx.new_line = false;
+            }
+        }
 
-constexpr inline auto unindent = op_unindent_t{};
+        // Ends the line in the default style and starts the next one with the prefix for depth, then restores style.
+        void write_line_break(std::size_t depth, const packed_font_style_t style) const
+        {
+            m_ctx.sink.append("\033[0m\n", 5);
+            write(m_ctx.prefixes->get(depth));
+            write_style_change(packed_font_style_t{}, style);
+        }
+    };
 
-constexpr inline auto text = [](std::string content) { return op_text_t{ std::move(content) }; };
+    // Writes text, new lines and indentation only; style, cursor and clear ops are skipped.
+    template <class Sink>
+    struct plain_visitor_t
+    {
+        context_t<Sink>& m_ctx;
 
-constexpr inline auto text_ref = [](std::string_view content) { return op_text_ref_t{ content }; };
+        void operator()(op_new_line_t) const
+        {
+            m_ctx.new_line = true;
+        }
 
-constexpr inline auto push_style = [](font_style_t style) { return op_push_style_t{ std::move(style) }; };
-constexpr inline auto modify_style = [](font_style_applier_t applier) { return op_modify_style_t{ std::move(applier) }; };
+        void operator()(op_indent_t) const
+        {
+            m_ctx.indent_level += 1;
+        }
 
-constexpr inline auto pop_style = op_pop_style_t{};
+        void operator()(op_unindent_t) const
+        {
+            m_ctx.indent_level = std::max(0, m_ctx.indent_level - 1);
+        }
 
-constexpr inline auto move_cursor = [](direction_t direction, int value) { return op_move_cursor{ direction, value }; };
-constexpr inline auto move_cursor_to = [](int row = 1, int column = 1) { return op_move_cursor_to{ row, column }; };
+        void operator()(const op_text_t& v) const
+        {
+            write_text(v.content);
+        }
 
-constexpr inline auto clear_screen
-    = [](clear_screen_mode_t mode = clear_screen_mode_t::full) { return op_clear_screen{ mode }; };
-constexpr inline auto clear_line = [](clear_line_mode_t mode = clear_line_mode_t::full) { return op_clear_line{ mode }; };
+        void operator()(const op_text_ref_t& v) const
+        {
+            write_text(v.content);
+        }
 
-constexpr inline auto set_cursor_visibility = [](bool value) { return op_set_cursor_visibility{ value }; };
+        void operator()(op_placeholder_t) const
+        {
+            write_text({});
+        }
 
-struct stream_t
-{
-    std::vector<stream_op_t> m_ops;
+        template <class Op>
+        void operator()(const Op&) const
+        {
+        }
 
-    stream_t() = default;
-    stream_t(const stream_t&) = default;
-    stream_t(stream_t&&) noexcept = default;
+        void write_text(std::string_view text) const
+        {
+            if (m_ctx.new_line)
+            {
+                write_line_break(static_cast<std::size_t>(m_ctx.indent_level));
+                m_ctx.new_line = false;
+            }
+            visitor_t<Sink>{ m_ctx }.write_text(text);
+        }
 
-    stream_t& operator<<(const stream_t& other)
+        // Unindented lines, the common case in plain logs, cost a single one-byte write.
+        void write_line_break(std::size_t depth) const
+        {
+            m_ctx.sink.append("\n", 1);
+            if (depth > 0)
+            {
+                const std::string_view prefix = m_ctx.prefixes->get_plain(depth);
+                m_ctx.sink.append(prefix.data(), prefix.size());
+            }
+        }
+    };
+
+    // Output modes of impl_t.
+    struct styled_mode_t
     {
-        m_ops.insert(m_ops.end(), other.m_ops.begin(), other.m_ops.end());
-        return *this;
-    }
+    };
 
-    stream_t& operator<<(stream_t&& other)
+    struct plain_mode_t
     {
-        m_ops.insert(m_ops.end(), std::make_move_iterator(other.m_ops.begin()), std::make_move_iterator(other.m_ops.end()));
-        return *this;
-    }
+    };
 
-    template <class T>
-    stream_t& operator<<(T&& item)
+    // Renders into a Sink, see sink.hpp. Sink is either a sink value (e.g. ostream_sink_t) or a reference to a sink
+    // owned by the caller. With Mode = plain_mode_t only text, new lines and indentation are written; styled output
+    // can also be switched to plain at run time with plain().
+    template <class Sink, class Mode = styled_mode_t>
+    struct impl_t
     {
-        if constexpr (std::is_constructible_v<stream_op_t, T>)
+        static constexpr bool always_plain = std::is_same_v<Mode, plain_mode_t>;
+
+        using sink_type = Sink;
+
+        // The transition cache given to the constructor or created by color_depth(), if any. Without one, renders
+        // use the thread's style_transition_cache_t::thread_local_instance() at full color depth, so rendering small
+        // documents neither allocates a cache nor starts from an empty one.
+        std::unique_ptr<style_transition_cache_t> m_own_cache;
+        style_transition_cache_t* m_cache;
+        mutable context_t<Sink> m_ctx;
+
+        // The plain visitor keeps no style stack, so a plain renderer allocates nothing.
+        impl_t(Sink sink)
+            : m_own_cache{}
+            , m_cache{}
+            , m_ctx{ std::forward<Sink>(sink),
+                     0,
+                     false,
+                     always_plain ? std::vector<packed_font_style_t>{} : std::vector{ packed_font_style_t{} } }
         {
-            m_ops.push_back(std::forward<T>(item));
         }
-        else if constexpr (std::is_invocable_v<T, stream_t&>)
+
+        impl_t(Sink sink, style_transition_cache_t& cache)
+            : m_own_cache{}
+            , m_cache{ &cache }
+            , m_ctx{ std::forward<Sink>(sink), 0, false, { packed_font_style_t{} } }
         {
-            std::invoke(std::forward<T>(item), *this);
         }
-        else
+
+        // A copy owns a copy of the owned transition cache; a cache passed to the constructor stays shared.
+        impl_t(const impl_t& other)
+            : m_own_cache{ other.m_own_cache ? std::make_unique<style_transition_cache_t>(*other.m_own_cache) : nullptr }
+            , m_cache{ other.m_own_cache ? m_own_cache.get() : other.m_cache }
+            , m_ctx{ other.m_ctx }
+            , m_auto_optimize{ other.m_auto_optimize }
+            , m_plain{ other.m_plain }
+            , m_prefixes{ other.m_prefixes }
         {
-            formatter_t<remove_cvref_t<T>>{}.format(*this, std::forward<T>(item));
         }
-        return *this;
-    }
-
-    template <class... Args>
-    stream_t& operator()(Args&&... args)
-    {
-        (*this << ... << std::forward<Args>(args));
-        return *this;
-    }
-};
-
-template <class... Args>
-stream_t& format_to(stream_t& stream, Args&&... args)
-{
-    return stream(std::forward<Args>(args)...);
-}
 
-template <class... Args>
-stream_t format(Args&&... args)
-{
-    stream_t stream;
-    return format_to(stream, std::forward<Args>(args)...);
-}
+        impl_t(impl_t&&) noexcept = default;
 
-struct render_fn
-{
-    template <int Base>
-    struct color_visitor_t
-    {
-        auto operator()(default_color_t) const -> std::vector<int>
+        // Draws indentation with the given prefixes instead of two spaces per level. The cache is not copied.
+        impl_t& indent_guides(indent_prefix_cache_t& prefixes)
         {
-            return { Base + 39 };
+            m_prefixes = &prefixes;
+            return *this;
         }
 
-        auto operator()(standard_color_t col) const -> std::vector<int>
+        // Renders an optimized copy of each stream, see optimize_fn.
+        impl_t& auto_optimize(bool value = true)
         {
-            return { Base + 30 + static_cast<int>(col.m_color) };
+            m_auto_optimize = value;
+            return *this;
         }
 
-        auto operator()(bright_color_t col) const -> std::vector<int>
+        // Downgrades colors to what the terminal can show, e.g. terminal_caps_t::current().color_depth, optionally
+        // quantizing to a custom palette. The setting is kept by the transition cache in use, so a shared cache keeps
+        // it for later renders; a renderer without a cache gets its own unless the setting is the default one.
+        impl_t& color_depth(color_depth_t depth, const color_quantizer_t* quantizer = nullptr)
         {
-            return { Base + 90 + static_cast<int>(col.m_color) };
+            if constexpr (!always_plain)
+            {
+                if (m_cache == nullptr && (depth != color_depth_t::truecolor || quantizer != nullptr))
+                {
+                    m_own_cache = std::make_unique<style_transition_cache_t>(256, depth);
+                    m_cache = m_own_cache.get();
+                }
+                if (m_cache != nullptr)
+                {
+                    m_cache->set_color_depth(depth, quantizer);
+                }
+            }
+            return *this;
         }
 
-        auto operator()(palette_color_t col) const -> std::vector<int>
+        // Writes text, new lines and indentation only, e.g. when the output is not a terminal.
+        impl_t& plain(bool value = true)
         {
-            return { Base + 38, 5, col.m_index };
+            m_plain = value;
+            return *this;
         }
 
-        auto operator()(rgb_color_t col) const -> std::vector<int>
+        // Escapes or strips control characters in text ops, for text from untrusted sources; see sanitize_fn.
+        impl_t& sanitize(sanitize_mode_t mode = sanitize_mode_t::escape)
         {
-            return { Base + 38, 2, col[0], col[1], col[2] };
+            m_ctx.sanitize = mode;
+            return *this;
         }
-    };
 
-    static const inline std::string esc = "\033";
-    static const inline std::string csi = esc + "[";
+        void operator()(const stream_t& stream) const
+        {
+            bind();
+            if (always_plain || m_plain)
+            {
+                stream.visit(plain_visitor_t<Sink>{ m_ctx });
+                finish();
+            }
+            else if (m_auto_optimize)
+            {
+                // The optimized ops are kept in a vector and a memory pool of the thread, so that after the first
+                // render they cost no allocations. The vector is taken out while in use, in case an applier renders.
+                static thread_local std::pmr::unsynchronized_pool_resource pool;
+                static thread_local std::pmr::vector<stream_op_t> scratch{ &pool };
+                std::pmr::vector<stream_op_t> ops = std::move(scratch);
+                ops.reserve(stream.size());
+                optimize(stream, ops);
+                render(ops);
+                ops.clear();
+                scratch = std::move(ops);
+            }
+            else
+            {
+                stream.visit(visitor_t<Sink>{ m_ctx });
+                finish();
+            }
+        }
 
-    static void write_args(std::ostream& os, const std::vector<int>& args)
-    {
-        os << csi;
-        for (std::size_t i = 0; i < args.size(); ++i)
+        // Renders any op source providing visit(visitor), which calls the visitor with each op in order.
+        template <
+            class Stream,
+            class = decltype(std::declval<const Stream&>().visit(std::declval<const visitor_t<Sink>&>()))>
+        void operator()(const Stream& stream) const
         {
-            if (i != 0)
+            bind();
+            if (always_plain || m_plain)
+            {
+                stream.visit(plain_visitor_t<Sink>{ m_ctx });
+            }
+            else
             {
-                os << ";";
+                stream.visit(visitor_t<Sink>{ m_ctx });
             }
-            os << args[i];
+            finish();
         }
-        os << "m";
-    }
 
-    static std::string write_args(const std::vector<int>& args)
-    {
-        std::stringstream ss;
-        write_args(ss, args);
-        return ss.str();
-    }
+        bool is_plain() const
+        {
+            return always_plain || m_plain;
+        }
 
-    static std::string change_style(const font_style_t& old_style, const font_style_t& new_style)
-    {
-        std::stringstream ss;
-        if (old_style.foreground != new_style.foreground)
+        // Points the context at the transition cache and the line prefixes for a render on the calling thread. The
+        // thread's caches are looked up here rather than on construction, so a renderer may be used on any thread.
+        void bind() const
         {
-            write_args(ss, std::visit(color_visitor_t<0>{}, new_style.foreground.m_data));
+            if (m_cache != nullptr)
+            {
+                m_ctx.cache = m_cache;
+            }
+            else
+            {
+                m_ctx.cache = &style_transition_cache_t::thread_local_instance();
+                m_ctx.cache->set_color_depth(color_depth_t::truecolor);
+            }
+            m_ctx.prefixes = m_prefixes != nullptr ? m_prefixes : &indent_prefix_cache_t::thread_local_instance();
         }
-        if (old_style.background != new_style.background)
+
+    private:
+        bool m_auto_optimize = false;
+        bool m_plain = false;
+        indent_prefix_cache_t* m_prefixes = nullptr;
+
+        void render(const std::pmr::vector<stream_op_t>& ops) const
         {
-            write_args(ss, std::visit(color_visitor_t<10>{}, new_style.background.m_data));
+            for (const auto& op : ops)
+            {
+                std::visit(visitor_t<Sink>{ m_ctx }, op);
+            }
+            finish();
         }
-        if (old_style.font != new_style.font)
+
+        void finish() const
         {
-            static const std::vector<std::pair<font_t, int>> set_map = {
-                { font_t::bold, 1 },      { font_t::dim, 2 },         { font_t::italic, 3 },
-                { font_t::underline, 4 }, { font_t::blink, 5 },       { font_t::inverse, 7 },
-                { font_t::hidden, 8 },    { font_t::crossed_out, 9 }, { font_t::double_underline, 21 },
-            };
-            std::vector<int> args = { 22, 23, 24, 25, 27, 28, 29 };
-            for (const auto& [f, v] : set_map)
+            if (m_ctx.new_line)
             {
-                if (new_style.font.contains(f))
-                {
-                    args.push_back(v);
-                }
+                m_ctx.sink.append("\n", 1);
             }
-            write_args(ss, args);
+            m_ctx.sink.flush();
         }
-        return ss.str();
-    }
+    };
 
-    struct context_t
+    // State shared by the outputs of a multi-output render.
+    struct multi_context_t
     {
-        std::ostream& os;
         int indent_level = 0;
         bool new_line = false;
-        std::vector<font_style_t> style_stack = { font_style_t{} };
+        std::vector<packed_font_style_t> style_stack = { packed_font_style_t{} };
     };
 
-    struct visitor_t
+    // Tracks layout and the style stack once and hands the resulting bytes to each renderer: the same text to all of
+    // them, and style changes, line prefixes, cursor and clear ops in each renderer's own encoding.
+    template <class... Impls>
+    struct multi_visitor_t
     {
-        context_t& m_ctx;
+        multi_context_t& m_ctx;
+        const std::tuple<Impls...>& m_impls;
 
         void operator()(op_new_line_t) const
         {
@@ -932,143 +2042,289 @@ struct render_fn
 
         void operator()(const op_text_t& v) const
         {
-            handle_indent();
-            m_ctx.os << v.content;
+            write_text(v.content);
         }
 
         void operator()(const op_text_ref_t& v) const
         {
-            handle_indent();
-            m_ctx.os << v.content;
+            write_text(v.content);
+        }
+
+        void operator()(op_placeholder_t) const
+        {
+            write_text({});
         }
 
         void operator()(const op_push_style_t& v) const
         {
-            const font_style_t previous_style = m_ctx.style_stack.back();
-            m_ctx.style_stack.push_back(v.style);
-            m_ctx.os << change_style(previous_style, m_ctx.style_stack.back());
+            push(packed_font_style_t{ v.style });
+        }
+
+        void operator()(const op_push_packed_style_t& v) const
+        {
+            push(v.style);
         }
 
         void operator()(const op_modify_style_t& v) const
         {
-            const font_style_t previous_style = m_ctx.style_stack.back();
-            font_style_t new_style = previous_style;
+            push(v.delta.apply(m_ctx.style_stack.back()));
+        }
+
+        void operator()(const op_apply_style_t& v) const
+        {
+            font_style_t new_style = m_ctx.style_stack.back().unpack();
             v.applier(new_style);
-            m_ctx.style_stack.push_back(new_style);
-            m_ctx.os << change_style(previous_style, m_ctx.style_stack.back());
+            push(packed_font_style_t{ new_style });
         }
 
         void operator()(op_pop_style_t) const
         {
-            const font_style_t previous_style = m_ctx.style_stack.back();
+            const packed_font_style_t previous_style = m_ctx.style_stack.back();
             m_ctx.style_stack.pop_back();
-            m_ctx.os << change_style(previous_style, m_ctx.style_stack.back());
+            write_style_change(previous_style, m_ctx.style_stack.back());
         }
 
-        void operator()(const op_move_cursor& v) const
+        // Cursor and clear ops.
+        template <class Op>
+        void operator()(const Op& op) const
         {
-            switch (v.direction)
-            {
-                case direction_t::up: m_ctx.os << csi << v.value << "A"; break;
-                case direction_t::down: m_ctx.os << csi << v.value << "B"; break;
-                case direction_t::forward: m_ctx.os << csi << v.value << "C"; break;
-                case direction_t::backward: m_ctx.os << csi << v.value << "D"; break;
-                case direction_t::next_line: m_ctx.os << csi << v.value << "E"; break;
-                case direction_t::prev_line: m_ctx.os << csi << v.value << "F"; break;
-                case direction_t::column: m_ctx.os << csi << v.value << "G"; break;
-                default: break;
-            }
+            for_each(
+                [&](const auto& impl)
+                {
+                    if (!impl.is_plain())
+                    {
+                        styled_visitor(impl)(op);
+                    }
+                });
         }
 
-        void operator()(const op_move_cursor_to& v) const
+        void push(const packed_font_style_t style) const
         {
-            m_ctx.os << csi << v.row << ";" << v.column << "H";
+            const packed_font_style_t previous_style = m_ctx.style_stack.back();
+            m_ctx.style_stack.push_back(style);
+            write_style_change(previous_style, style);
         }
 
-        void operator()(const op_clear_screen& v) const
+        void write_style_change(const packed_font_style_t old_style, const packed_font_style_t new_style) const
         {
-            switch (v.mode)
+            if (old_style == new_style)
             {
-                case clear_screen_mode_t::to_end: m_ctx.os << csi << "0J"; break;
-                case clear_screen_mode_t::to_begin: m_ctx.os << csi << "1J"; break;
-                case clear_screen_mode_t::full: m_ctx.os << csi << "2J"; break;
-                case clear_screen_mode_t::scrollback: m_ctx.os << csi << "3J"; break;
-                default: break;
+                return;
             }
+            for_each(
+                [&](const auto& impl)
+                {
+                    if (!impl.is_plain())
+                    {
+                        styled_visitor(impl).write_style_change(old_style, new_style);
+                    }
+                });
         }
 
-        void operator()(const op_clear_line& v) const
+        void write_text(std::string_view text) const
         {
-            switch (v.mode)
-            {
-                case clear_line_mode_t::to_end: m_ctx.os << csi << "0K"; break;
-                case clear_line_mode_t::to_begin: m_ctx.os << csi << "1K"; break;
-                case clear_line_mode_t::full: m_ctx.os << csi << "2K"; break;
-                default: break;
-            }
+            const bool new_line = std::exchange(m_ctx.new_line, false);
+            const std::size_t depth = static_cast<std::size_t>(m_ctx.indent_level);
+            for_each(
+                [&](const auto& impl)
+                {
+                    if (new_line && impl.is_plain())
+                    {
+                        plain_visitor(impl).write_line_break(depth);
+                    }
+                    else if (new_line)
+                    {
+                        styled_visitor(impl).write_line_break(depth, m_ctx.style_stack.back());
+                    }
+                    styled_visitor(impl).write_text(text);
+                });
         }
 
-        void operator()(const op_set_cursor_visibility& v) const
+        template <class Func>
+        void for_each(Func&& func) const
         {
-            m_ctx.os << csi << (v.value ? "?25h" : "?25l");
+            std::apply([&](const auto&... impls) { (func(impls), ...); }, m_impls);
         }
 
-        void handle_indent() const
+        template <class Sink, class Mode>
+        static visitor_t<Sink> styled_visitor(const impl_t<Sink, Mode>& impl)
         {
-            if (m_ctx.new_line)
-            {
-                m_ctx.os << write_args({ 0 });
-                m_ctx.os << "\n" << std::string(m_ctx.indent_level * 2, ' ');
-                m_ctx.new_line = false;
-                m_ctx.os << change_style({}, m_ctx.style_stack.back());
-            }
+            return visitor_t<Sink>{ impl.m_ctx };
         }
-    };
-
-    struct impl_t
-    {
-        mutable context_t m_ctx;
 
-        impl_t(std::ostream& out) : m_ctx{ out, 0, false }
+        template <class Sink, class Mode>
+        static plain_visitor_t<Sink> plain_visitor(const impl_t<Sink, Mode>& impl)
         {
+            return plain_visitor_t<Sink>{ impl.m_ctx };
         }
+    };
 
-        void operator()(const stream_t& stream) const
+    // Renders each stream into the outputs of several renderers with a single visit, see all().
+    template <class... Impls>
+    struct multi_impl_t
+    {
+        std::tuple<Impls...> m_impls;
+        mutable multi_context_t m_ctx = {};
+
+        template <
+            class Stream,
+            class = decltype(std::declval<const Stream&>().visit(std::declval<const multi_visitor_t<Impls...>&>()))>
+        void operator()(const Stream& stream) const
         {
-            for (const auto& op : stream.m_ops)
-            {
-                std::visit(visitor_t{ m_ctx }, op);
-            }
-            if (m_ctx.new_line)
-            {
-                m_ctx.os << "\n";
-            }
+            std::apply([](const auto&... impls) { (impls.bind(), ...); }, m_impls);
+            stream.visit(multi_visitor_t<Impls...>{ m_ctx, m_impls });
+            multi_visitor_t<Impls...>{ m_ctx, m_impls }.for_each(
+                [&](const auto& impl)
+                {
+                    if (m_ctx.new_line)
+                    {
+                        impl.m_ctx.sink.append("\n", 1);
+                    }
+                    impl.m_ctx.sink.flush();
+                });
+            m_ctx.indent_level = 0;
+            m_ctx.new_line = false;
+            m_ctx.style_stack.assign(1, packed_font_style_t{});
         }
     };
 
-    auto operator()(std::ostream& out) const -> impl_t
+    // Out is an std::ostream, std::string, std::vector<char> or a Sink.
+    template <class Out>
+    auto operator()(Out& out) const -> impl_t<decltype(make_sink(out))>
+    {
+        return impl_t<decltype(make_sink(out))>{ make_sink(out) };
+    }
+
+    template <class Out>
+    auto operator()(Out& out, style_transition_cache_t& cache) const -> impl_t<decltype(make_sink(out))>
+    {
+        return impl_t<decltype(make_sink(out))>{ make_sink(out), cache };
+    }
+
+    // Writes text, new lines and indentation only; no style state is kept.
+    template <class Out>
+    auto plain(Out& out) const -> impl_t<decltype(make_sink(out)), plain_mode_t>
+    {
+        return impl_t<decltype(make_sink(out)), plain_mode_t>{ make_sink(out) };
+    }
+
+    // Renders the same document for outputs with different capabilities in one pass over the ops:
+    //
+    //     ansi::render.all(
+    //         ansi::render(std::cout),
+    //         ansi::render(pane).color_depth(ansi::color_depth_t::palette),
+    //         ansi::render.plain(log_file))(stream);
+    //
+    // Each renderer writes to its own sink with its own color depth, indent guides and plain setting; auto_optimize() is
+    // not applied. The renderers are moved, or copied when named, into the result, which can be kept and called again.
+    // A transition cache holds a single color depth, the one set last, so renderers given a cache must not share it.
+    template <class... Impls>
+    auto all(Impls&&... impls) const -> multi_impl_t<remove_cvref_t<Impls>...>
+    {
+        multi_impl_t<remove_cvref_t<Impls>...> result{ { std::forward<Impls>(impls)... } };
+        assert(distinct_caches(result.m_impls));
+        return result;
+    }
+
+private:
+    template <class Impls>
+    static bool distinct_caches(const Impls& impls)
     {
-        return impl_t{ out };
+        std::vector<const style_transition_cache_t*> caches;
+        std::apply(
+            [&](const auto&... impl) { (caches.push_back(impl.is_plain() ? nullptr : impl.m_cache), ...); }, impls);
+        std::sort(caches.begin(), caches.end());
+        return std::adjacent_find(
+                   caches.begin(),
+                   caches.end(),
+                   [](const style_transition_cache_t* lhs, const style_transition_cache_t* rhs)
+                   { return lhs != nullptr && lhs == rhs; })
+               == caches.end();
     }
 };
 
 constexpr inline auto render = render_fn{};
 
+// SGR bytes switching between two styles, or from the default style, computed at compile time when the styles are
+// constant:
+//
+//     static constexpr auto error_style = ansi::escape_literal(ansi::bold | ansi::red);
+//     os.write(error_style.data(), error_style.size());
+constexpr inline struct escape_literal_fn
+{
+    constexpr auto operator()(const font_style_t& old_style, const font_style_t& new_style) const -> sgr_encoder_t
+    {
+        sgr_encoder_t result{};
+        render_fn::change_style(result, old_style, new_style);
+        return result;
+    }
+
+    constexpr auto operator()(const font_style_t& style) const -> sgr_encoder_t
+    {
+        return (*this)(font_style_t{}, style);
+    }
+
+    constexpr auto operator()(const style_delta_t& delta) const -> sgr_encoder_t
+    {
+        return (*this)(delta.apply(packed_font_style_t{}).unpack());
+    }
+} escape_literal{};
+
+// Unevaluated sequence of items returned by the builders below. Inserting it into a stream appends the items directly
+// to that stream, so nested builders do not create intermediate streams. Converting it to stream_t materializes it.
+template <class... Items>
+struct sequence_t
+{
+    std::tuple<Items...> m_items;
+
+    template <class Stream>
+    constexpr void operator()(Stream& out) const&
+    {
+        std::apply([&](const auto&... items) { (out << ... << items); }, m_items);
+    }
+
+    template <class Stream>
+    constexpr void operator()(Stream& out) &&
+    {
+        std::apply([&](auto&... items) { (out << ... << std::move(items)); }, m_items);
+    }
+
+    operator stream_t() const&
+    {
+        stream_t result;
+        (*this)(result);
+        return result;
+    }
+
+    operator stream_t() &&
+    {
+        stream_t result;
+        std::move(*this)(result);
+        return result;
+    }
+};
+
+template <class... Items>
+constexpr auto make_sequence(Items&&... items) -> sequence_t<std::decay_t<Items>...>
+{
+    return { std::tuple<std::decay_t<Items>...>{ std::forward<Items>(items)... } };
+}
+
 constexpr inline struct indented_fn
 {
     template <class... Ops>
-    auto operator()(Ops&&... ops) const -> stream_t
+    constexpr auto operator()(Ops&&... ops) const
     {
-        return stream_t{}(indent, std::forward<Ops>(ops)..., unindent);
+        return make_sequence(indent, std::forward<Ops>(ops)..., unindent);
     }
 } indented{};
 
 constexpr inline struct line_fn
 {
     template <class... Ops>
-    auto operator()(Ops&&... ops) const -> stream_t
+    constexpr auto operator()(Ops&&... ops) const
     {
-        return stream_t{}(std::forward<Ops>(ops)..., new_line);
+        return make_sequence(std::forward<Ops>(ops)..., new_line);
     }
 } line{};
 
@@ -1079,13 +2335,13 @@ constexpr inline struct set_style_fn
         font_style_t m_style;
 
         template <class... Ops>
-        auto operator()(Ops&&... ops) const -> stream_t
+        constexpr auto operator()(Ops&&... ops) const
         {
-            return stream_t{} << push_style(m_style) << (... << std::forward<Ops>(ops)) << pop_style;
+            return make_sequence(push_style(m_style), std::forward<Ops>(ops)..., pop_style);
         }
     };
 
-    auto operator()(font_style_t style) const -> impl_t
+    constexpr auto operator()(font_style_t style) const -> impl_t
     {
         return { std::move(style) };
     }
@@ -1093,18 +2349,24 @@ constexpr inline struct set_style_fn
 
 constexpr inline struct change_style_fn
 {
+    template <class Modifier>
     struct impl_t
     {
-        font_style_applier_t m_applier;
+        Modifier m_modifier;
 
         template <class... Ops>
-        auto operator()(Ops&&... ops) const -> stream_t
+        constexpr auto operator()(Ops&&... ops) const
         {
-            return stream_t{} << modify_style(m_applier) << (... << std::forward<Ops>(ops)) << pop_style;
+            return make_sequence(modify_style(m_modifier), std::forward<Ops>(ops)..., pop_style);
         }
     };
 
-    auto operator()(font_style_applier_t applier) const -> impl_t
+    constexpr auto operator()(style_delta_t delta) const -> impl_t<style_delta_t>
+    {
+        return { delta };
+    }
+
+    auto operator()(font_style_applier_t applier) const -> impl_t<font_style_applier_t>
     {
         return { std::move(applier) };
     }
@@ -1148,7 +2410,7 @@ struct ostream_formatter_t
     {
         std::stringstream ss;
         ss << item;
-        stream << text(ss.str());
+        stream << text(ss.str(), stream.get_allocator());
     }
 };
 
@@ -1178,7 +2440,7 @@ struct sprintf_formatter_t
         static const char fmt[] = { '%', Fmt..., '\0' };
         char buffer[64];
         int chars_written = std::sprintf(buffer, fmt, item);
-        stream << text(std::string(buffer, chars_written));
+        stream << text(std::string_view(buffer, chars_written), stream.get_allocator());
     }
 };
 
@@ -1281,9 +2543,9 @@ struct formatter_t<std::string_view>
 template <>
 struct formatter_t<std::string>
 {
-    void format(stream_t& stream, std::string item) const
+    void format(stream_t& stream, const std::string& item) const
     {
-        stream << text(std::move(item));
+        stream << text(item, stream.get_allocator());
     }
 };
 
@@ -1292,7 +2554,7 @@ struct formatter_t<char>
 {
     void format(stream_t& stream, char item) const
     {
-        stream << text(std::string(1, item));
+        stream << text(std::string_view(&item, 1), stream.get_allocator());
     }
 };
 
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <ferrugo/ansi3/stream.hpp>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ansi
+{
+
+// What the terminal can display, as far as the environment tells:
+//
+//     ansi::render(std::cout).color_depth(ansi::terminal_caps_t::current().color_depth)(stream);
+//
+// detect() checks, in order: NO_COLOR (any non-empty value disables colors), COLORTERM ("truecolor" or "24bit"),
+// TERM ("dumb" or unset disables colors), the "colors" number of the compiled terminfo entry for TERM, and finally
+// the TERM name itself ("-direct", "-truecolor", "-256color").
+struct terminal_caps_t
+{
+    using getenv_t = std::function<const char*(const char*)>;
+
+    color_depth_t color_depth = color_depth_t::none;
+
+    static terminal_caps_t detect(const getenv_t& getenv = &std::getenv)
+    {
+        const auto env = [&](const char* name) -> std::string_view
+        {
+            const char* value = getenv(name);
+            return value != nullptr ? value : "";
+        };
+
+        if (!env("NO_COLOR").empty())
+        {
+            return terminal_caps_t{ color_depth_t::none };
+        }
+        const std::string_view colorterm = env("COLORTERM");
+        if (colorterm == "truecolor" || colorterm == "24bit")
+        {
+            return terminal_caps_t{ color_depth_t::truecolor };
+        }
+        const std::string_view term = env("TERM");
+        if (term.empty() || term == "dumb")
+        {
+            return terminal_caps_t{ color_depth_t::none };
+        }
+        const int colors = terminfo_colors(term, getenv);
+        if (colors >= (1 << 24))
+        {
+            return terminal_caps_t{ color_depth_t::truecolor };
+        }
+        if (colors >= 256)
+        {
+            return terminal_caps_t{ color_depth_t::palette };
+        }
+        if (colors >= 8)
+        {
+            return terminal_caps_t{ color_depth_t::basic };
+        }
+        if (colors >= 0)
+        {
+            return terminal_caps_t{ color_depth_t::none };
+        }
+        if (ends_with(term, "-direct") || ends_with(term, "-truecolor"))
+        {
+            return terminal_caps_t{ color_depth_t::truecolor };
+        }
+        if (ends_with(term, "-256color"))
+        {
+            return terminal_caps_t{ color_depth_t::palette };
+        }
+        return terminal_caps_t{ color_depth_t::basic };
+    }
+
+    // Detected once per process from the environment.
+    static const terminal_caps_t& current()
+    {
+        static const terminal_caps_t instance = detect();
+        return instance;
+    }
+
+    // The "colors" number of the compiled terminfo entry for term: 0 if the entry has no such number (a monochrome
+    // terminal), -1 if no readable entry was found. Entries are looked up in $TERMINFO, ~/.terminfo, $TERMINFO_DIRS
+    // and the usual system directories.
+    static int terminfo_colors(std::string_view term, const getenv_t& getenv = &std::getenv)
+    {
+        if (term.empty() || term.find('/') != std::string_view::npos || term.front() == '.')
+        {
+            return -1;
+        }
+        for (const std::string& dir : terminfo_dirs(getenv))
+        {
+            static constexpr char hex[] = "0123456789abcdef";
+            const auto first = static_cast<unsigned char>(term.front());
+            const std::string subdirs[] = { std::string(1, term.front()), std::string{ hex[first >> 4], hex[first & 15] } };
+            for (const std::string& subdir : subdirs)
+            {
+                std::ifstream file{ dir + "/" + subdir + "/" + std::string{ term }, std::ios::binary };
+                if (file)
+                {
+                    return parse_colors(std::string{ std::istreambuf_iterator<char>{ file }, {} });
+                }
+            }
+        }
+        return -1;
+    }
+
+    // Reads the "colors" number (index 13) from a compiled terminfo entry, in the legacy (16-bit numbers) or the
+    // extended (32-bit numbers) format. Returns 0 if the number is absent and -1 if the data is not an entry.
+    static int parse_colors(std::string_view data)
+    {
+        static constexpr std::size_t colors_index = 13;
+        const auto u16 = [&](std::size_t offset)
+        { return int(static_cast<unsigned char>(data[offset])) | int(static_cast<unsigned char>(data[offset + 1])) << 8; };
+
+        if (data.size() < 12)
+        {
+            return -1;
+        }
+        const int magic = u16(0);
+        const std::size_t number_size = magic == 0432 ? 2 : magic == 01036 ? 4 : 0;
+        if (number_size == 0)
+        {
+            return -1;
+        }
+        const std::size_t names_size = static_cast<std::size_t>(u16(2));
+        const std::size_t bool_count = static_cast<std::size_t>(u16(4));
+        const std::size_t number_count = static_cast<std::size_t>(u16(6));
+        std::size_t offset = 12 + names_size + bool_count;
+        offset += offset % 2;
+        offset += colors_index * number_size;
+        if (number_count <= colors_index)
+        {
+            return 0;
+        }
+        if (offset + number_size > data.size())
+        {
+            return -1;
+        }
+        // Negative values mark absent or cancelled numbers.
+        if (number_size == 2)
+        {
+            const int value = u16(offset);
+            return value >= 0x8000 ? 0 : value;
+        }
+        const std::uint32_t value
+            = static_cast<std::uint32_t>(u16(offset)) | static_cast<std::uint32_t>(u16(offset + 2)) << 16;
+        return value >= 0x80000000u ? 0 : static_cast<int>(value);
+    }
+
+private:
+    static std::vector<std::string> terminfo_dirs(const getenv_t& getenv)
+    {
+        static const char* const system_dirs[] = { "/etc/terminfo", "/lib/terminfo", "/usr/share/terminfo" };
+        std::vector<std::string> result;
+        if (const char* dir = getenv("TERMINFO"); dir != nullptr && *dir != '\0')
+        {
+            result.push_back(dir);
+        }
+        if (const char* home = getenv("HOME"); home != nullptr && *home != '\0')
+        {
+            result.push_back(std::string{ home } + "/.terminfo");
+        }
+        if (const char* dirs = getenv("TERMINFO_DIRS"); dirs != nullptr)
+        {
+            std::string_view list = dirs;
+            while (true)
+            {
+                const std::size_t end = std::min(list.find(':'), list.size());
+                // An empty entry stands for the system directory.
+                result.push_back(end == 0 ? std::string{ "/usr/share/terminfo" } : std::string{ list.substr(0, end) });
+                if (end == list.size())
+                {
+                    break;
+                }
+                list.remove_prefix(end + 1);
+            }
+        }
+        result.insert(result.end(), std::begin(system_dirs), std::end(system_dirs));
+        return result;
+    }
+
+    static bool ends_with(std::string_view text, std::string_view suffix)
+    {
+        return text.size() >= suffix.size() && text.substr(text.size() - suffix.size()) == suffix;
+    }
+};
+
+}  // namespace ansi
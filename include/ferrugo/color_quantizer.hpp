@@ -0,0 +1,646 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace ferrugo
+{
+namespace color
+{
+
+// Terminal colors, the color depths of terminals and the quantizer mapping colors to a smaller depth. Shared by the
+// engines that downgrade colors, without the rest of their rendering.
+
+enum class basic_color_t
+{
+    black,
+    red,
+    green,
+    yellow,
+    blue,
+    magenta,
+    cyan,
+    white,
+};
+
+inline std::ostream& operator<<(std::ostream& os, basic_color_t item)
+{
+#define CASE(v) \
+    case basic_color_t::v: return os << #v
+    switch (item)
+    {
+        CASE(black);
+        CASE(red);
+        CASE(green);
+        CASE(yellow);
+        CASE(blue);
+        CASE(magenta);
+        CASE(cyan);
+        CASE(white);
+        default: throw std::runtime_error{ "unknown basic_color_t" };
+    }
+#undef CASE
+    return os;
+}
+
+struct default_color_t
+{
+    constexpr friend bool operator==(default_color_t, default_color_t)
+    {
+        return true;
+    }
+
+    constexpr friend bool operator!=(default_color_t, default_color_t)
+    {
+        return false;
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, default_color_t)
+    {
+        return os << "default_color";
+    }
+};
+
+struct standard_color_t
+{
+    basic_color_t m_color;
+
+    constexpr explicit standard_color_t(basic_color_t color) : m_color(color)
+    {
+    }
+
+    constexpr friend bool operator==(const standard_color_t& lhs, const standard_color_t& rhs)
+    {
+        return lhs.m_color == rhs.m_color;
+    }
+
+    constexpr friend bool operator!=(const standard_color_t& lhs, const standard_color_t& rhs)
+    {
+        return !(lhs == rhs);
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, const standard_color_t item)
+    {
+        return os << "{:standard_color " << item.m_color << "}";
+    }
+};
+
+struct bright_color_t
+{
+    basic_color_t m_color;
+
+    constexpr explicit bright_color_t(basic_color_t color) : m_color(color)
+    {
+    }
+
+    constexpr friend bool operator==(const bright_color_t& lhs, const bright_color_t& rhs)
+    {
+        return lhs.m_color == rhs.m_color;
+    }
+
+    constexpr friend bool operator!=(const bright_color_t& lhs, const bright_color_t& rhs)
+    {
+        return !(lhs == rhs);
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, const bright_color_t item)
+    {
+        return os << "{:bright_color " << item.m_color << "}";
+    }
+};
+
+struct rgb_color_t : public std::array<std::uint8_t, 3>
+{
+    using base_t = std::array<std::uint8_t, 3>;
+    using base_t::base_t;
+
+    constexpr rgb_color_t(std::uint8_t r, std::uint8_t g, std::uint8_t b) : base_t{ { r, g, b } }
+    {
+    }
+
+    constexpr explicit rgb_color_t(std::string_view txt) : rgb_color_t{ 0, 0, 0 }
+    {
+        if (txt.front() == '#')
+        {
+            txt.remove_prefix(1);
+        }
+        assert(txt.size() == 6);
+        for (std::size_t i = 0; i < 3; ++i)
+        {
+            (*this)[i] = parse_sub(txt.substr(2 * i, 2));
+        }
+    }
+
+    // std::array's comparison is not constexpr before C++20.
+    constexpr friend bool operator==(const rgb_color_t& lhs, const rgb_color_t& rhs)
+    {
+        return lhs[0] == rhs[0] && lhs[1] == rhs[1] && lhs[2] == rhs[2];
+    }
+
+    constexpr friend bool operator!=(const rgb_color_t& lhs, const rgb_color_t& rhs)
+    {
+        return !(lhs == rhs);
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, const rgb_color_t& item)
+    {
+        return os << "{:rgb_color ["  //
+                  << static_cast<int>(item[0]) << " " << static_cast<int>(item[1]) << " " << static_cast<int>(item[2])
+                  << "]}";
+    }
+
+private:
+    static std::uint8_t parse_sub(std::string_view str)
+    {
+        std::stringstream ss;
+        ss << std::hex << str;
+        std::int16_t result;
+        ss >> result;
+        return static_cast<std::uint8_t>(result);
+    }
+};
+
+struct palette_color_t
+{
+    std::uint8_t m_index;
+
+    constexpr explicit palette_color_t(std::uint8_t index) : m_index{ index }
+    {
+    }
+
+    constexpr explicit palette_color_t(standard_color_t col)
+        : palette_color_t{ static_cast<std::uint8_t>(static_cast<int>(col.m_color) + 0) }
+    {
+    }
+
+    constexpr explicit palette_color_t(bright_color_t col)
+        : palette_color_t{ static_cast<std::uint8_t>(static_cast<int>(col.m_color) + 8) }
+    {
+    }
+
+    constexpr explicit palette_color_t(basic_color_t col) : palette_color_t{ standard_color_t{ col } }
+    {
+    }
+
+    static palette_color_t from_rgb(const std::array<std::uint8_t, 3>& values)
+    {
+        std::uint8_t index = 0;
+        int e = 36;
+        for (std::size_t i = 0; i < 3; ++i)
+        {
+            assert(values[i] < 6);
+            index += e * values[i];
+            e /= 6;
+        }
+        return palette_color_t{ static_cast<std::uint8_t>(index + 16) };
+    }
+
+    static palette_color_t from_rgb(std::uint8_t r, std::uint8_t g, std::uint8_t b)
+    {
+        return from_rgb({ r, g, b });
+    }
+
+    static palette_color_t from_grayscale(std::uint8_t brightness)
+    {
+        assert(brightness < 24);
+        return palette_color_t{ static_cast<std::uint8_t>(brightness + 232) };
+    }
+
+    // Color of the index in the default xterm palette.
+    constexpr rgb_color_t to_rgb() const
+    {
+        constexpr std::uint8_t system[16][3] = {
+            { 0, 0, 0 },       { 205, 0, 0 },   { 0, 205, 0 },   { 205, 205, 0 },
+            { 0, 0, 238 },     { 205, 0, 205 }, { 0, 205, 205 }, { 229, 229, 229 },
+            { 127, 127, 127 }, { 255, 0, 0 },   { 0, 255, 0 },   { 255, 255, 0 },
+            { 92, 92, 255 },   { 255, 0, 255 }, { 0, 255, 255 }, { 255, 255, 255 },
+        };
+        constexpr std::uint8_t cube[6] = { 0, 95, 135, 175, 215, 255 };
+        if (m_index < 16)
+        {
+            return rgb_color_t{ system[m_index][0], system[m_index][1], system[m_index][2] };
+        }
+        if (m_index < 232)
+        {
+            const int i = m_index - 16;
+            return rgb_color_t{ cube[i / 36], cube[i / 6 % 6], cube[i % 6] };
+        }
+        const auto gray = static_cast<std::uint8_t>(8 + 10 * (m_index - 232));
+        return rgb_color_t{ gray, gray, gray };
+    }
+
+    bool is_standard_color() const
+    {
+        return 0 <= m_index && m_index <= 7;
+    }
+
+    bool is_bright_color() const
+    {
+        return 8 <= m_index && m_index <= 15;
+    }
+
+    bool is_grayscale() const
+    {
+        return 232 <= m_index && m_index <= 255;
+    }
+
+    bool is_rgb() const
+    {
+        return 16 <= m_index && m_index <= 231;
+    }
+
+    constexpr friend bool operator==(const palette_color_t lhs, const palette_color_t rhs)
+    {
+        return lhs.m_index == rhs.m_index;
+    }
+
+    constexpr friend bool operator!=(const palette_color_t lhs, const palette_color_t rhs)
+    {
+        return !(lhs == rhs);
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, const palette_color_t item)
+    {
+        return os << "{:palette_color " << static_cast<int>(item.m_index) << "}";
+    }
+};
+
+struct color_t
+{
+    using data_type = std::variant<default_color_t, standard_color_t, bright_color_t, palette_color_t, rgb_color_t>;
+
+    data_type m_data;
+
+    constexpr color_t() : m_data{ std::in_place_type<default_color_t>, default_color_t{} }
+    {
+    }
+
+    constexpr color_t(default_color_t col) : m_data{ std::in_place_type<default_color_t>, col }
+    {
+    }
+
+    constexpr color_t(standard_color_t col) : m_data{ std::in_place_type<standard_color_t>, col }
+    {
+    }
+
+    constexpr color_t(basic_color_t col) : color_t{ standard_color_t{ col } }
+    {
+    }
+
+    constexpr color_t(bright_color_t col) : m_data{ std::in_place_type<bright_color_t>, col }
+    {
+    }
+
+    constexpr color_t(palette_color_t col) : m_data{ std::in_place_type<palette_color_t>, col }
+    {
+    }
+
+    constexpr color_t(rgb_color_t col) : m_data{ std::in_place_type<rgb_color_t>, col }
+    {
+    }
+
+    constexpr color_t(std::string_view txt) : color_t{ rgb_color_t{ txt } }
+    {
+    }
+
+    constexpr color_t(const char* txt) : color_t{ std::string_view(txt) }
+    {
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, const color_t& item)
+    {
+        std::visit([&](const auto& c) { os << c; }, item.m_data);
+        return os;
+    }
+
+    constexpr friend bool operator==(const color_t& lhs, const color_t& rhs)
+    {
+        return lhs.m_data == rhs.m_data;
+    }
+
+    constexpr friend bool operator!=(const color_t& lhs, const color_t& rhs)
+    {
+        return !(lhs == rhs);
+    }
+};
+
+// Colors a terminal can display, from no color at all to 24-bit color.
+enum class color_depth_t
+{
+    none,
+    basic,
+    palette,
+    truecolor,
+};
+
+inline std::ostream& operator<<(std::ostream& os, color_depth_t item)
+{
+#define CASE(v) \
+    case color_depth_t::v: return os << #v
+    switch (item)
+    {
+        CASE(none);
+        CASE(basic);
+        CASE(palette);
+        CASE(truecolor);
+        default: throw std::runtime_error{ "unknown color_depth_t" };
+    }
+#undef CASE
+    return os;
+}
+
+// Maps 24-bit colors to the perceptually nearest entry of a 256-color palette. Nearness uses the "redmean" weighted
+// RGB distance. Lookup tables with 32 levels per channel (64 KiB each) are built once, for the 240 cube and gray
+// entries (the 16 system colors are left out, since terminal themes usually redefine them) and for the 16 system
+// colors; a third table maps each palette index to the nearest system color.
+//
+// A cell of the tables that lies wholly on one side of every boundary between entries gives its entry directly. A
+// cell the boundaries cross (two thirds of them for the xterm cube) keeps the few entries, three on average, that
+// can be nearest to one of its colors, and compares them exactly, so results always equal nearest().
+//
+//     const ansi::color_quantizer_t& q = ansi::color_quantizer_t::default_instance();
+//     const palette_color_t c = q.to_palette(rgb_color_t{ 250, 128, 114 });
+//
+// Terminals with a custom palette can pass its colors to the constructor.
+struct color_quantizer_t
+{
+    using palette_type = std::array<rgb_color_t, 256>;
+
+    static constexpr int lut_bits = 5;
+    static constexpr std::size_t lut_size = std::size_t(1) << (3 * lut_bits);
+
+    // Each cell holds either its entry (below 256) or 256 + i, its candidates being those from m_ranges[i] up to
+    // m_ranges[i + 1].
+    struct table_t
+    {
+        std::vector<std::uint16_t> m_cells;
+        std::vector<std::uint32_t> m_ranges;
+        std::vector<std::uint8_t> m_candidates;
+    };
+
+    palette_type m_palette;
+    table_t m_to_palette;
+    table_t m_to_basic;
+    std::array<std::uint8_t, 256> m_palette_to_basic;
+
+    explicit color_quantizer_t(const palette_type& palette = default_palette())
+        : m_palette{ palette }
+        , m_to_palette{ build_table(16, 256) }
+        , m_to_basic{ build_table(0, 16) }
+        , m_palette_to_basic{}
+    {
+        for (std::size_t i = 0; i < 256; ++i)
+        {
+            m_palette_to_basic[i] = i < 16 ? static_cast<std::uint8_t>(i) : nearest(m_palette[i], 0, 16);
+        }
+    }
+
+    // Shared quantizer for the default xterm palette, built on first use.
+    static const color_quantizer_t& default_instance()
+    {
+        static const color_quantizer_t instance;
+        return instance;
+    }
+
+    static palette_type default_palette()
+    {
+        palette_type result = {};
+        for (std::size_t i = 0; i < 256; ++i)
+        {
+            result[i] = palette_color_t{ static_cast<std::uint8_t>(i) }.to_rgb();
+        }
+        return result;
+    }
+
+    palette_color_t to_palette(const rgb_color_t& rgb) const
+    {
+        return palette_color_t{ lookup(m_to_palette, rgb) };
+    }
+
+    // Index 0-15 of the nearest standard (0-7) or bright (8-15) color.
+    std::uint8_t to_basic(const rgb_color_t& rgb) const
+    {
+        return lookup(m_to_basic, rgb);
+    }
+
+    std::uint8_t to_basic(const palette_color_t color) const
+    {
+        return m_palette_to_basic[color.m_index];
+    }
+
+    // Exact search over the palette entries [first, last); ties go to the lower index. Entries are only compared
+    // in full when their red and green terms alone do not exceed the best distance so far.
+    std::uint8_t nearest(const rgb_color_t& rgb, std::size_t first, std::size_t last) const
+    {
+        std::size_t result = first;
+        int best = distance(rgb, m_palette[first]);
+        for (std::size_t i = first + 1; i < last; ++i)
+        {
+            const rgb_color_t& entry = m_palette[i];
+            const int mean_red = (int(rgb[0]) + int(entry[0])) / 2;
+            const int r = int(rgb[0]) - int(entry[0]);
+            int d = ((512 + mean_red) * r * r) >> 8;
+            if (d >= best)
+            {
+                continue;
+            }
+            const int g = int(rgb[1]) - int(entry[1]);
+            d += 4 * g * g;
+            if (d >= best)
+            {
+                continue;
+            }
+            const int b = int(rgb[2]) - int(entry[2]);
+            d += ((767 - mean_red) * b * b) >> 8;
+            if (d < best)
+            {
+                best = d;
+                result = i;
+            }
+        }
+        return static_cast<std::uint8_t>(result);
+    }
+
+    static int distance(const rgb_color_t& lhs, const rgb_color_t& rhs)
+    {
+        const int mean_red = (int(lhs[0]) + int(rhs[0])) / 2;
+        const int r = int(lhs[0]) - int(rhs[0]);
+        const int g = int(lhs[1]) - int(rhs[1]);
+        const int b = int(lhs[2]) - int(rhs[2]);
+        return (((512 + mean_red) * r * r) >> 8) + 4 * g * g + (((767 - mean_red) * b * b) >> 8);
+    }
+
+private:
+    static std::size_t cell(const rgb_color_t& rgb)
+    {
+        constexpr int shift = 8 - lut_bits;
+        return (std::size_t(rgb[0] >> shift) << (2 * lut_bits)) | (std::size_t(rgb[1] >> shift) << lut_bits)
+               | std::size_t(rgb[2] >> shift);
+    }
+
+    std::uint8_t lookup(const table_t& table, const rgb_color_t& rgb) const
+    {
+        const std::uint16_t value = table.m_cells[cell(rgb)];
+        if (value < 256)
+        {
+            return static_cast<std::uint8_t>(value);
+        }
+        const std::uint32_t begin = table.m_ranges[value - 256u];
+        const std::uint32_t end = table.m_ranges[value - 255u];
+        std::uint8_t result = table.m_candidates[begin];
+        int best = distance(rgb, m_palette[result]);
+        for (std::uint32_t i = begin + 1; i < end; ++i)
+        {
+            const int d = distance(rgb, m_palette[table.m_candidates[i]]);
+            if (d < best)
+            {
+                best = d;
+                result = table.m_candidates[i];
+            }
+        }
+        return result;
+    }
+
+    // Bounds the distance from the colors of a cell to each entry in [first, last). Entries whose lower bound exceeds
+    // the smallest upper bound cannot be nearest anywhere in the cell; the others are its candidates, in index order
+    // so that ties are broken as in nearest(). The red and green terms of the bounds depend on one level each, and the
+    // blue terms on the red and blue levels, so they are computed per level and only summed per cell.
+    table_t build_table(std::size_t first, std::size_t last) const
+    {
+        constexpr int levels = 1 << lut_bits;
+        constexpr int width = 1 << (8 - lut_bits);
+        const std::size_t count = last - first;
+        // Distances from the entries to the nearest and farthest value of each level, per channel.
+        const auto offsets = [&](int channel, int level, int& near, int& far, std::size_t i)
+        {
+            const int lo = level * width;
+            const int hi = lo + width - 1;
+            const int e = m_palette[first + i][channel];
+            near = e < lo ? lo - e : e > hi ? e - hi : 0;
+            far = std::max(std::abs(lo - e), std::abs(hi - e));
+        };
+
+        std::vector<int> red_green_lower(count);
+        std::vector<int> red_green_upper(count);
+        std::vector<int> blue_lower(levels * count);
+        std::vector<int> blue_upper(levels * count);
+        table_t table;
+        table.m_cells.resize(lut_size);
+        for (int red = 0; red < levels; ++red)
+        {
+            std::vector<int> red_lower(count);
+            std::vector<int> red_upper(count);
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                const int min_mean_red = (red * width + m_palette[first + i][0]) / 2;
+                const int max_mean_red = (red * width + width - 1 + m_palette[first + i][0]) / 2;
+                int near = 0;
+                int far = 0;
+                offsets(0, red, near, far, i);
+                red_lower[i] = ((512 + min_mean_red) * near * near) >> 8;
+                red_upper[i] = ((512 + max_mean_red) * far * far) >> 8;
+                for (int blue = 0; blue < levels; ++blue)
+                {
+                    offsets(2, blue, near, far, i);
+                    blue_lower[blue * count + i] = ((767 - max_mean_red) * near * near) >> 8;
+                    blue_upper[blue * count + i] = ((767 - min_mean_red) * far * far) >> 8;
+                }
+            }
+            for (int green = 0; green < levels; ++green)
+            {
+                for (std::size_t i = 0; i < count; ++i)
+                {
+                    int near = 0;
+                    int far = 0;
+                    offsets(1, green, near, far, i);
+                    red_green_lower[i] = red_lower[i] + 4 * near * near;
+                    red_green_upper[i] = red_upper[i] + 4 * far * far;
+                }
+                for (int blue = 0; blue < levels; ++blue)
+                {
+                    const int* lower = blue_lower.data() + blue * count;
+                    const int* upper = blue_upper.data() + blue * count;
+                    int min_upper = std::numeric_limits<int>::max();
+                    for (std::size_t i = 0; i < count; ++i)
+                    {
+                        min_upper = std::min(min_upper, red_green_upper[i] + upper[i]);
+                    }
+                    const auto begin = static_cast<std::uint32_t>(table.m_candidates.size());
+                    for (std::size_t i = 0; i < count; ++i)
+                    {
+                        if (red_green_lower[i] + lower[i] <= min_upper)
+                        {
+                            table.m_candidates.push_back(static_cast<std::uint8_t>(first + i));
+                        }
+                    }
+                    const auto end = static_cast<std::uint32_t>(table.m_candidates.size());
+                    std::uint16_t& cell = table.m_cells[(std::size_t(red) << (2 * lut_bits)) | (green << lut_bits) | blue];
+                    if (end - begin == 1)
+                    {
+                        cell = table.m_candidates.back();
+                        table.m_candidates.pop_back();
+                    }
+                    else
+                    {
+                        cell = static_cast<std::uint16_t>(256 + table.m_ranges.size());
+                        table.m_ranges.push_back(begin);
+                    }
+                }
+            }
+        }
+        table.m_ranges.push_back(static_cast<std::uint32_t>(table.m_candidates.size()));
+        return table;
+    }
+};
+
+// Replaces colors the given depth cannot show by the nearest color it can: truecolor by the 256-color palette,
+// palette colors by the 16 standard and bright colors, and any color by the default color for color_depth_t::none.
+constexpr inline struct downgrade_fn
+{
+    color_t operator()(
+        const color_t& color,
+        color_depth_t depth,
+        const color_quantizer_t& quantizer = color_quantizer_t::default_instance()) const
+    {
+        if (depth == color_depth_t::truecolor)
+        {
+            return color;
+        }
+        if (depth == color_depth_t::none)
+        {
+            return default_color_t{};
+        }
+        if (const auto rgb = std::get_if<rgb_color_t>(&color.m_data))
+        {
+            return depth == color_depth_t::palette ? color_t{ quantizer.to_palette(*rgb) }
+                                                   : basic(quantizer.to_basic(*rgb));
+        }
+        if (const auto palette = std::get_if<palette_color_t>(&color.m_data); palette && depth == color_depth_t::basic)
+        {
+            return basic(quantizer.to_basic(*palette));
+        }
+        return color;
+    }
+
+private:
+    static color_t basic(std::uint8_t index)
+    {
+        const auto color = static_cast<basic_color_t>(index % 8);
+        return index < 8 ? color_t{ standard_color_t{ color } } : color_t{ bright_color_t{ color } };
+    }
+} downgrade{};
+
+}  // namespace color
+}  // namespace ferrugo
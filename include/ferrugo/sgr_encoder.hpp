@@ -0,0 +1,114 @@
+#pragma once
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace ferrugo
+{
+namespace sgr
+{
+
+struct digits_t
+{
+    std::array<char, 3> m_chars;
+    std::uint8_t m_size;
+};
+
+// Decimal digits of the SGR parameters 0-255.
+constexpr inline auto digits = []() -> std::array<digits_t, 256>
+{
+    std::array<digits_t, 256> result = {};
+    for (int i = 0; i < 256; ++i)
+    {
+        digits_t& d = result[i];
+        if (i >= 100)
+        {
+            d.m_chars[d.m_size++] = static_cast<char>('0' + i / 100);
+        }
+        if (i >= 10)
+        {
+            d.m_chars[d.m_size++] = static_cast<char>('0' + i / 10 % 10);
+        }
+        d.m_chars[d.m_size++] = static_cast<char>('0' + i % 10);
+    }
+    return result;
+}();
+
+// Encodes SGR sequences (CSI n;...;n m) into a fixed-capacity stack buffer, so that a whole style change
+// can be handed to the output in a single write. Shared by all the engines.
+struct encoder_t
+{
+    static constexpr std::size_t capacity = 128;
+
+    std::array<char, capacity> m_data = {};
+    std::size_t m_size = 0;
+    bool m_first_arg = true;
+
+    constexpr encoder_t& begin()
+    {
+        append('\033');
+        append('[');
+        m_first_arg = true;
+        return *this;
+    }
+
+    constexpr encoder_t& arg(std::uint8_t value)
+    {
+        if (!m_first_arg)
+        {
+            append(';');
+        }
+        const digits_t& d = digits[value];
+        assert(m_size + d.m_size <= capacity);
+        for (std::uint8_t i = 0; i < d.m_size; ++i)
+        {
+            m_data[m_size++] = d.m_chars[i];
+        }
+        m_first_arg = false;
+        return *this;
+    }
+
+    constexpr encoder_t& end()
+    {
+        append('m');
+        return *this;
+    }
+
+    constexpr void clear()
+    {
+        m_size = 0;
+    }
+
+    constexpr bool empty() const
+    {
+        return m_size == 0;
+    }
+
+    constexpr const char* data() const
+    {
+        return m_data.data();
+    }
+
+    constexpr std::size_t size() const
+    {
+        return m_size;
+    }
+
+    constexpr std::string_view view() const
+    {
+        return { data(), size() };
+    }
+
+private:
+    constexpr void append(char ch)
+    {
+        assert(m_size < capacity);
+        m_data[m_size++] = ch;
+    }
+};
+
+}  // namespace sgr
+}  // namespace ferrugo
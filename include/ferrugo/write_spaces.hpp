@@ -0,0 +1,23 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <ostream>
+#include <string_view>
+
+namespace ferrugo
+{
+
+// Writes count spaces in writes of up to 64 characters, without building a string.
+inline void write_spaces(std::ostream& os, std::size_t count)
+{
+    static constexpr std::string_view spaces = "                                                                ";
+    while (count > 0)
+    {
+        const std::size_t size = std::min(count, spaces.size());
+        os.write(spaces.data(), static_cast<std::streamsize>(size));
+        count -= size;
+    }
+}
+
+}  // namespace ferrugo
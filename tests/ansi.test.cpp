@@ -1,5 +1,1180 @@
+#include <algorithm>
+#include <array>
+#include <catch2/catch_test_macros.hpp>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <ferrugo/ansi3/compact_stream.hpp>
+#include <ferrugo/ansi3/fd_sink.hpp>
+#include <ferrugo/ansi3/html.hpp>
+#include <ferrugo/ansi3/mmap_sink.hpp>
+#include <ferrugo/ansi3/render_plan.hpp>
+#include <ferrugo/ansi3/sanitize.hpp>
+#include <ferrugo/ansi3/serialize.hpp>
+#include <ferrugo/ansi3/static_document.hpp>
+#include <ferrugo/ansi3/stream.hpp>
+#include <ferrugo/ansi3/terminal.hpp>
+#include <ferrugo/sgr_encoder.hpp>
+#include <map>
+#include <memory_resource>
+#include <pthread.h>
+#include <random>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <sys/time.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_set>
+#include <vector>
 
+namespace
+{
+
+template <class Stream>
+std::string render_to_string(const Stream& stream)
+{
+    std::string result;
+    ansi::render(result)(stream);
+    return result;
+}
+
+// A stream of random ops, including the redundant sequences the optimizer removes.
+ansi::stream_t random_stream(std::mt19937& rng, std::size_t size)
+{
+    static const std::string long_word(300, 'w');
+    static const std::string_view words[] = { "", "a", "lorem", "ipsum dolor", "x\ny", "\n", long_word };
+    static const ansi::font_style_t styles[] = {
+        ansi::font_style_t{},
+        ansi::font_style_t{ ansi::basic_color_t::red },
+        ansi::font_style_t{ ansi::basic_color_t::green, {}, ansi::font_t::bold },
+        ansi::font_style_t{ ansi::rgb_color_t{ 10, 20, 30 }, ansi::palette_color_t{ 200 } },
+    };
+    static const ansi::style_delta_t deltas[] = { ansi::bold, ansi::red, ansi::bold | ansi::blue, ansi::style_delta_t{} };
+
+    const auto pick = [&](std::size_t n) { return std::uniform_int_distribution<std::size_t>{ 0, n - 1 }(rng); };
+    ansi::stream_t result;
+    std::size_t depth = 0;
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        switch (pick(11))
+        {
+            case 0: result << ansi::new_line; break;
+            case 1: result << ansi::indent; break;
+            case 2: result << ansi::unindent; break;
+            case 3: result << ansi::text(words[pick(std::size(words))]); break;
+            case 4: result << ansi::text_ref(words[pick(std::size(words))]); break;
+            case 5: result << ansi::push_style(styles[pick(std::size(styles))]), ++depth; break;
+            case 6: result << ansi::modify_style(deltas[pick(std::size(deltas))]), ++depth; break;
+            case 7:
+                result << ansi::modify_style(ansi::font_style_applier_t{ [](ansi::font_style_t& s)
+                                                                          { s.font |= ansi::font_t::italic; } }),
+                    ++depth;
+                break;
+            case 8:
+                switch (pick(5))
+                {
+                    case 0: result << ansi::move_cursor(ansi::direction_t::backward, static_cast<int>(pick(300))); break;
+                    case 1: result << ansi::move_cursor_to(static_cast<int>(pick(200)), 1); break;
+                    case 2: result << ansi::clear_screen(ansi::clear_screen_mode_t::to_end); break;
+                    case 3: result << ansi::clear_line(); break;
+                    default: result << ansi::set_cursor_visibility(pick(2) == 0); break;
+                }
+                break;
+            default:
+                if (depth > 0)
+                {
+                    result << ansi::pop_style, --depth;
+                }
+                break;
+        }
+    }
+    for (; depth > 0; --depth)
+    {
+        result << ansi::pop_style;
+    }
+    return result;
+}
+
+// A compiled terminfo entry whose numbers are all absent except "colors" (index 13), if given and below number_count.
+std::string terminfo_entry(int magic, std::size_t number_count, int colors)
+{
+    const std::size_t number_size = magic == 0432 ? 2 : 4;
+    std::string result;
+    const auto put = [&](std::uint32_t value, std::size_t size)
+    {
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            result += static_cast<char>((value >> (8 * i)) & 0xFF);
+        }
+    };
+    const std::string_view names{ "test|ferrugo test", 18 };
+    const std::size_t bool_count = 3;
+    // The header ends with the sizes of the (empty) string offsets and string table.
+    for (const std::size_t value : { std::size_t(magic), names.size(), bool_count, number_count, std::size_t(0) })
+    {
+        put(static_cast<std::uint32_t>(value), 2);
+    }
+    put(0, 2);
+    result += names;
+    result.append(bool_count, '\1');
+    if (result.size() % 2 != 0)
+    {
+        result += '\0';
+    }
+    for (std::size_t i = 0; i < number_count; ++i)
+    {
+        put(static_cast<std::uint32_t>(i == 13 ? colors : -1), number_size);
+    }
+    return result;
+}
+
+constexpr auto rgb_transition = ansi::escape_literal(
+    ansi::font_style_t{ ansi::rgb_color_t{ 1, 2, 3 } }, ansi::font_style_t{ ansi::rgb_color_t{ 250, 0, 17 } });
+static_assert(rgb_transition.view() == "\033[38;2;250;0;17m");
+static_assert(ansi::escape_literal(ansi::fg(ansi::rgb_color_t{ 4, 5, 6 })).view() == "\033[38;2;4;5;6m");
+
+}  // namespace
+
+TEST_CASE("optimize keeps the rendered bytes", "[ansi3][optimize]")
+{
+    std::mt19937 rng{ 5 };
+    for (int i = 0; i < 500; ++i)
+    {
+        ansi::stream_t stream = random_stream(rng, 60);
+        const std::string expected = render_to_string(stream);
+        const std::size_t size = stream.size();
+        const std::size_t removed = ansi::optimize(stream);
+        REQUIRE(stream.size() + removed == size);
+        REQUIRE(render_to_string(stream) == expected);
+    }
+}
+
+TEST_CASE("auto_optimize renders the same bytes as render", "[ansi3][optimize]")
+{
+    std::mt19937 rng{ 6 };
+    for (int i = 0; i < 500; ++i)
+    {
+        const ansi::stream_t stream = random_stream(rng, 60);
+        std::string optimized;
+        ansi::render(optimized).auto_optimize()(stream);
+        REQUIRE(optimized == render_to_string(stream));
+    }
+}
+
+TEST_CASE("optimize merges owned text and leaves text refs alone", "[ansi3][optimize]")
+{
+    ansi::stream_t stream;
+    stream << ansi::text("a") << ansi::text("b") << ansi::text_ref("c") << ansi::text_ref("d") << ansi::text("e");
+    REQUIRE(ansi::optimize(stream) == 1);
+    REQUIRE(stream.size() == 4);
+    REQUIRE(std::get<ansi::op_text_t>(stream.m_ops[0]).content == "ab");
+    REQUIRE(std::holds_alternative<ansi::op_text_ref_t>(stream.m_ops[1]));
+    REQUIRE(std::holds_alternative<ansi::op_text_ref_t>(stream.m_ops[2]));
+}
+
+TEST_CASE("optimize allocates from the memory resource of the output", "[ansi3][optimize]")
+{
+    ansi::stream_t stream;
+    stream << ansi::text("a long enough text to leave the small string buffer") << ansi::text("b")
+           << ansi::modify_style(ansi::bold) << ansi::push_style(ansi::font_style_t{}) << ansi::text_ref("c")
+           << ansi::pop_style << ansi::pop_style;
+    // Anything taken from the global heap instead of the arena would throw std::bad_alloc.
+    std::array<std::byte, 4096> buffer;
+    std::pmr::monotonic_buffer_resource arena{ buffer.data(), buffer.size(), std::pmr::null_memory_resource() };
+    std::pmr::vector<ansi::stream_op_t> out{ &arena };
+    ansi::optimize(stream, out);
+    REQUIRE(out.size() == 6);
+    const auto& text = std::get<ansi::op_text_t>(out[0]);
+    REQUIRE(text.content == "a long enough text to leave the small string bufferb");
+    REQUIRE(text.content.get_allocator().resource() == &arena);
+}
+
+TEST_CASE("optimize drops empty indentation and style pairs that change nothing", "[ansi3][optimize]")
+{
+    ansi::stream_t stream;
+    stream << ansi::indent << ansi::indent << ansi::unindent << ansi::unindent << ansi::push_style(ansi::font_style_t{})
+           << ansi::pop_style << ansi::modify_style(ansi::bold) << ansi::pop_style << ansi::text_ref("x");
+    REQUIRE(ansi::optimize(stream) == 6);
+    REQUIRE(stream.size() == 3);
+    REQUIRE(std::holds_alternative<ansi::op_modify_style_t>(stream.m_ops[0]));
+}
+
+TEST_CASE("compact_stream_t renders the same bytes as stream_t", "[ansi3][compact_stream]")
+{
+    std::mt19937 rng{ 7 };
+    for (int i = 0; i < 500; ++i)
+    {
+        const ansi::stream_t stream = random_stream(rng, 60);
+        ansi::compact_stream_t compact;
+        compact << stream;
+        REQUIRE(compact.size() == stream.size());
+        REQUIRE(render_to_string(compact) == render_to_string(stream));
+    }
+}
+
+TEST_CASE("compact_stream_t stores each style once", "[ansi3][compact_stream]")
+{
+    const ansi::font_style_t style{ ansi::basic_color_t::red };
+    ansi::compact_stream_t compact;
+    for (int i = 0; i < 10; ++i)
+    {
+        compact << ansi::push_style(style) << ansi::text_ref("x") << ansi::pop_style;
+    }
+    REQUIRE(compact.m_styles.size() == 1);
+    REQUIRE(compact.m_text == "xxxxxxxxxx");
+}
+
+TEST_CASE("fd_sink_t writes every byte to a pipe that takes partial writes", "[ansi3][fd_sink]")
+{
+    const std::string long_text(3000, 'l');
+    ansi::stream_t stream;
+    for (int i = 0; i < 2000; ++i)
+    {
+        stream << ansi::change_style(i % 2 == 0 ? ansi::bold : ansi::red)("item ", i) << ansi::new_line
+               << ansi::text_ref(long_text) << ansi::indented(ansi::line("x"));
+    }
+    const std::string expected = render_to_string(stream);
+
+    int fds[2];
+    REQUIRE(::pipe(fds) == 0);
+#if defined(F_SETPIPE_SZ)
+    ::fcntl(fds[1], F_SETPIPE_SZ, 4096);
+#endif
+    std::string received;
+    std::thread reader{ [&]
+                        {
+                            sigset_t signals;
+                            sigemptyset(&signals);
+                            sigaddset(&signals, SIGALRM);
+                            pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+                            char buffer[1000];
+                            ssize_t size;
+                            while ((size = ::read(fds[0], buffer, sizeof(buffer))) > 0)
+                            {
+                                received.append(buffer, static_cast<std::size_t>(size));
+                            }
+                        } };
+
+    // A signal interrupts writev while it waits for the full pipe, so it returns after writing only part of the data.
+    struct sigaction action = {};
+    struct sigaction previous_action = {};
+    action.sa_handler = [](int) {};
+    sigaction(SIGALRM, &action, &previous_action);
+    itimerval timer = { { 0, 100 }, { 0, 100 } };
+    setitimer(ITIMER_REAL, &timer, nullptr);
+    std::size_t bytes_written = 0;
+    {
+        ansi::fd_sink_t out{ fds[1], 4096 };
+        ansi::render(out)(stream);
+        bytes_written = out.bytes_written();
+    }
+    timer = {};
+    setitimer(ITIMER_REAL, &timer, nullptr);
+    sigaction(SIGALRM, &previous_action, nullptr);
+    ::close(fds[1]);
+    reader.join();
+    ::close(fds[0]);
+
+    REQUIRE(bytes_written == expected.size());
+    REQUIRE(received == expected);
+}
+
+TEST_CASE("mmap_sink_t writes across extents and truncates the file to what was written", "[ansi3][mmap_sink]")
+{
+    const std::string path = (std::filesystem::temp_directory_path() / "ferrugo-ansi-tests-mmap.txt").string();
+    const auto read_file = [&]()
+    {
+        std::ifstream file{ path, std::ios::binary };
+        return std::string{ std::istreambuf_iterator<char>{ file }, std::istreambuf_iterator<char>{} };
+    };
+    const std::size_t page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+    std::mt19937 rng{ 16 };
+    // Pieces of odd sizes, one spanning several extents, ending a few bytes into the fourth extent.
+    std::string expected;
+    for (const std::size_t size : { std::size_t(1000), 2 * page + 123, page - 1000 - 123 + 1, page - 2, std::size_t(7) })
+    {
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            expected += static_cast<char>('a' + rng() % 26);
+        }
+    }
+    const auto write = [&](ansi::mmap_sink_t& sink, std::string_view data)
+    {
+        for (std::size_t offset = 0; offset < data.size();)
+        {
+            const std::size_t size = std::min<std::size_t>(data.size() - offset, offset == 1000 ? 2 * page + 123 : 1000);
+            sink.append(data.data() + offset, size);
+            offset += size;
+        }
+    };
+
+    SECTION("close")
+    {
+        ansi::mmap_sink_t sink{ path, 1 };
+        write(sink, expected);
+        REQUIRE(sink.size() == expected.size());
+        sink.close();
+        REQUIRE(std::filesystem::file_size(path) == expected.size());
+        REQUIRE(read_file() == expected);
+        sink.close();
+    }
+    SECTION("destructor")
+    {
+        {
+            ansi::mmap_sink_t sink{ path, 1 };
+            write(sink, expected);
+        }
+        REQUIRE(read_file() == expected);
+    }
+    SECTION("exactly one extent")
+    {
+        {
+            ansi::mmap_sink_t sink{ path, 1 };
+            write(sink, expected.substr(0, page));
+        }
+        REQUIRE(read_file() == expected.substr(0, page));
+    }
+    SECTION("nothing written")
+    {
+        ansi::mmap_sink_t{ path, 1 };
+        REQUIRE(std::filesystem::file_size(path) == 0);
+    }
+    SECTION("rendered stream")
+    {
+        ansi::stream_t stream;
+        for (int i = 0; i < 1000; ++i)
+        {
+            stream << ansi::push_style(ansi::font_style_t{ ansi::basic_color_t::red }) << ansi::text_ref("line")
+                   << ansi::pop_style << ansi::new_line;
+        }
+        {
+            ansi::mmap_sink_t sink{ path, 1 };
+            ansi::render(sink)(stream);
+        }
+        REQUIRE(read_file() == render_to_string(stream));
+    }
+    std::remove(path.c_str());
+}
+
+TEST_CASE("serialized streams render the same bytes as the original", "[ansi3][serialize]")
+{
+    std::mt19937 rng{ 8 };
+    for (int i = 0; i < 500; ++i)
+    {
+        const ansi::stream_t stream = random_stream(rng, 60);
+        const std::string data = ansi::serialize(stream);
+        const ansi::serialized_view_t view{ data.data(), data.size() };
+        REQUIRE(render_to_string(view) == render_to_string(stream));
+    }
+}
+
+TEST_CASE("mapped_stream_t renders a serialized file", "[ansi3][serialize]")
+{
+    std::mt19937 rng{ 9 };
+    const ansi::stream_t stream = random_stream(rng, 500);
+    const std::string path = (std::filesystem::temp_directory_path() / "ferrugo-ansi-tests.fans").string();
+    {
+        std::ofstream file{ path, std::ios::binary };
+        ansi::serialize(stream, file);
+    }
+    {
+        const ansi::mapped_stream_t mapped{ path };
+        REQUIRE(mapped.size() == stream.size());
+        REQUIRE(render_to_string(mapped) == render_to_string(stream));
+    }
+    std::remove(path.c_str());
+}
+
+TEST_CASE("serialized_view_t rejects corrupted input", "[ansi3][serialize]")
+{
+    ansi::stream_t stream;
+    stream << ansi::push_style(ansi::font_style_t{ ansi::basic_color_t::red }) << ansi::text_ref("hello")
+           << ansi::pop_style << ansi::move_cursor(ansi::direction_t::up, 300) << ansi::clear_line() << ansi::new_line;
+    const std::string data = ansi::serialize(stream);
+    const std::size_t code_offset = ansi::serialized_format_t::header_size + 8;
+    const std::size_t code_size = data.size() - code_offset - 5;
+    const auto parse = [](const std::string& bytes) { return ansi::serialized_view_t{ bytes.data(), bytes.size() }; };
+    const auto with_code = [&](std::string code, std::size_t op_count = 1)
+    {
+        std::string result = data.substr(0, code_offset) + code + data.substr(code_offset + code_size);
+        ansi::serialized_format_t::put_u64(result.data() + 8, op_count);
+        ansi::serialized_format_t::put_u64(result.data() + 24, code.size());
+        return result;
+    };
+    const std::string code = data.substr(code_offset, code_size);
+    const auto op = [](ansi::opcode_t opcode) { return std::string(1, static_cast<char>(opcode)); };
+
+    REQUIRE(render_to_string(parse(data)) == render_to_string(stream));
+    SECTION("other format versions")
+    {
+        for (const std::uint32_t version : { 0u, 1u, ansi::serialized_format_t::version + 1 })
+        {
+            std::string other = data;
+            ansi::serialized_format_t::put_u32(other.data() + 4, version);
+            REQUIRE_THROWS_AS(parse(other), std::runtime_error);
+        }
+    }
+    SECTION("every truncation")
+    {
+        for (std::size_t size = 0; size < data.size(); ++size)
+        {
+            REQUIRE_THROWS_AS(parse(data.substr(0, size)), std::runtime_error);
+        }
+    }
+    SECTION("style index past the style table")
+    {
+        REQUIRE_NOTHROW(parse(with_code(op(ansi::opcode_t::push_style) + '\x00')));
+        REQUIRE_THROWS_AS(parse(with_code(op(ansi::opcode_t::push_style) + '\x01')), std::runtime_error);
+    }
+    SECTION("text longer than the text pool")
+    {
+        REQUIRE_NOTHROW(parse(with_code(op(ansi::opcode_t::text) + '\x05')));
+        REQUIRE_THROWS_AS(
+            parse(with_code(op(ansi::opcode_t::text) + '\x05' + op(ansi::opcode_t::text) + '\x01', 2)),
+            std::runtime_error);
+    }
+    SECTION("varint running past the code")
+    {
+        REQUIRE_THROWS_AS(parse(with_code(op(ansi::opcode_t::placeholder) + '\x80')), std::runtime_error);
+        REQUIRE_THROWS_AS(
+            parse(with_code(op(ansi::opcode_t::placeholder) + std::string(10, '\x80') + '\x01')), std::runtime_error);
+    }
+    SECTION("one-byte operand after the last byte")
+    {
+        REQUIRE_NOTHROW(parse(with_code(op(ansi::opcode_t::clear_line) + '\x00')));
+        REQUIRE_THROWS_AS(parse(with_code(op(ansi::opcode_t::clear_line))), std::runtime_error);
+        REQUIRE_THROWS_AS(parse(with_code(op(ansi::opcode_t::set_cursor_visibility))), std::runtime_error);
+        REQUIRE_THROWS_AS(parse(with_code(op(ansi::opcode_t::move_cursor))), std::runtime_error);
+    }
+    SECTION("pop_style without a style to pop")
+    {
+        REQUIRE_THROWS_AS(parse(with_code(op(ansi::opcode_t::pop_style))), std::runtime_error);
+        const std::string push = op(ansi::opcode_t::push_style) + '\x00';
+        const std::string pop = op(ansi::opcode_t::pop_style);
+        REQUIRE_NOTHROW(parse(with_code(push + pop, 2)));
+        REQUIRE_THROWS_AS(parse(with_code(push + pop + pop, 3)), std::runtime_error);
+    }
+    SECTION("op count different from the header")
+    {
+        REQUIRE_THROWS_AS(parse(with_code(code, 5)), std::runtime_error);
+        REQUIRE_THROWS_AS(parse(with_code(code, 7)), std::runtime_error);
+    }
+    SECTION("unknown opcodes and operand values")
+    {
+        REQUIRE_THROWS_AS(parse(with_code(std::string(1, '\x7f'))), std::runtime_error);
+        REQUIRE_THROWS_AS(parse(with_code(op(ansi::opcode_t::apply_style) + '\x00')), std::runtime_error);
+        REQUIRE_THROWS_AS(parse(with_code(op(ansi::opcode_t::clear_screen) + '\x09')), std::runtime_error);
+    }
+    SECTION("every single-byte change of the code")
+    {
+        // Each change is either rejected or decodes within bounds; the sanitizers catch the latter going wrong.
+        for (std::size_t i = 0; i < code_size; ++i)
+        {
+            for (int value = 0; value < 256; ++value)
+            {
+                std::string corrupted = data;
+                corrupted[code_offset + i] = static_cast<char>(value);
+                try
+                {
+                    render_to_string(parse(corrupted));
+                }
+                catch (const std::runtime_error&)
+                {
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE("render_html draws indentation with the indent guides of render", "[ansi3][html]")
+{
+    ansi::render_fn::indent_prefix_cache_t guides{ {
+        ansi::render_fn::indent_guide_t{ "| ", ansi::font_style_t{ ansi::basic_color_t::blue } },
+        ansi::render_fn::indent_guide_t{ "<>", ansi::font_style_t{} },
+    } };
+    ansi::stream_t stream;
+    stream << "a" << ansi::indent << ansi::new_line << "b" << ansi::indent << ansi::new_line << "c";
+
+    std::string html;
+    ansi::render_html(html).indent_guides(guides)(stream);
+    const std::string body = html.substr(html.find("<pre"));
+    REQUIRE(
+        body
+        == "<pre class=\"ansi\">a\n<span class=\"ansi-0\">| </span>b\n<span class=\"ansi-0\">| </span>&lt;&gt;c</pre>\n");
+
+    std::string plain;
+    ansi::render(plain).plain().indent_guides(guides)(stream);
+    REQUIRE(plain == "a\n| b\n| <>c");
+}
+
+TEST_CASE("render_html writes the pending new line and indentation at a placeholder", "[ansi3][html]")
+{
+    ansi::stream_t stream;
+    stream << "a" << ansi::indent << ansi::new_line << ansi::placeholder(0) << ansi::new_line << ansi::placeholder(1)
+           << "b";
+
+    std::string html;
+    ansi::render_html(html)(stream);
+    REQUIRE(html.substr(html.find("<pre")) == "<pre class=\"ansi\">a\n  \n  b</pre>\n");
+
+    std::string plain;
+    ansi::render.plain(plain)(stream);
+    REQUIRE(plain == "a\n  \n  b");
+}
+
+TEST_CASE("color_quantizer_t gives the exact nearest entry", "[ansi3][color_quantizer]")
+{
+    const ansi::color_quantizer_t& q = ansi::color_quantizer_t::default_instance();
+    const auto check = [&](const ansi::rgb_color_t& rgb)
+    {
+        REQUIRE(q.to_palette(rgb).m_index == q.nearest(rgb, 16, 256));
+        REQUIRE(q.to_basic(rgb) == q.nearest(rgb, 0, 16));
+    };
+    // Every color of a few cells the boundaries between entries cross, then random colors.
+    for (const int base : { 0x706868, 0x282828, 0xf8f8f8 })
+    {
+        for (int offset = 0; offset < 8 * 8 * 8; ++offset)
+        {
+            check(ansi::rgb_color_t{ static_cast<std::uint8_t>((base >> 16) + (offset >> 6)),
+                                     static_cast<std::uint8_t>(((base >> 8) & 0xff) + ((offset >> 3) & 7)),
+                                     static_cast<std::uint8_t>((base & 0xff) + (offset & 7)) });
+        }
+    }
+    std::mt19937 rng{ 21 };
+    for (int i = 0; i < 100000; ++i)
+    {
+        const auto value = static_cast<std::uint32_t>(rng());
+        check(ansi::rgb_color_t{ static_cast<std::uint8_t>(value >> 16),
+                                 static_cast<std::uint8_t>(value >> 8),
+                                 static_cast<std::uint8_t>(value) });
+    }
+}
+
+TEST_CASE("render.all writes what separate renders write", "[ansi3][render_all]")
+{
+    std::mt19937 rng{ 22 };
+    std::string truecolor;
+    std::string palette;
+    std::string basic;
+    std::string plain;
+    auto basic_renderer = ansi::render(basic);
+    basic_renderer.color_depth(ansi::color_depth_t::basic);
+    // Kept past the expression that created it, and given both temporaries and a named renderer.
+    const auto all = ansi::render.all(
+        ansi::render(truecolor),
+        ansi::render(palette).color_depth(ansi::color_depth_t::palette),
+        basic_renderer,
+        ansi::render.plain(plain));
+    for (int i = 0; i < 200; ++i)
+    {
+        const ansi::stream_t stream = random_stream(rng, 60);
+        all(stream);
+
+        std::string expected;
+        ansi::render(expected)(stream);
+        REQUIRE(truecolor == expected);
+        expected.clear();
+        ansi::render(expected).color_depth(ansi::color_depth_t::palette)(stream);
+        REQUIRE(palette == expected);
+        expected.clear();
+        ansi::render(expected).color_depth(ansi::color_depth_t::basic)(stream);
+        REQUIRE(basic == expected);
+        expected.clear();
+        ansi::render.plain(expected)(stream);
+        REQUIRE(plain == expected);
+        for (std::string* out : { &truecolor, &palette, &basic, &plain })
+        {
+            out->clear();
+        }
+    }
+}
+
+TEST_CASE("render_plan_t writes what render writes with the values in place", "[ansi3][render_plan]")
+{
+    static const std::string_view words[] = { "", "a", "lorem", "ipsum dolor", "x\ny" };
+    std::mt19937 rng{ 23 };
+    const auto pick = [&](std::size_t n) { return std::uniform_int_distribution<std::size_t>{ 0, n - 1 }(rng); };
+    for (int i = 0; i < 500; ++i)
+    {
+        ansi::stream_t stream;
+        for (const ansi::stream_op_t& op : random_stream(rng, 60).m_ops)
+        {
+            stream.m_ops.push_back(op);
+            if (pick(4) == 0)
+            {
+                stream << ansi::placeholder(pick(3));
+            }
+        }
+        const std::vector<ansi::plan_value_t> values = { words[pick(5)], words[pick(5)], words[pick(5)] };
+
+        ansi::stream_t substituted;
+        for (const ansi::stream_op_t& op : stream.m_ops)
+        {
+            const auto* slot = std::get_if<ansi::op_placeholder_t>(&op);
+            if (slot != nullptr)
+            {
+                substituted << ansi::text_ref(values[slot->index].text);
+            }
+            else
+            {
+                substituted.m_ops.push_back(op);
+            }
+        }
+
+        const ansi::render_plan_t plan{ stream };
+        std::string rendered;
+        plan(rendered, values);
+        REQUIRE(rendered == render_to_string(substituted));
+    }
+}
+
+TEST_CASE("static_document writes what render writes", "[ansi3][static_document]")
+{
+    static constexpr auto styled = []
+    {
+        return ansi::make_sequence(
+            "no line break yet",
+            ansi::line(ansi::change_style(ansi::bold | ansi::cyan)("title"), " 1.0"),
+            ansi::set_style(ansi::font_style_t{ ansi::rgb_color_t{ 10, 20, 30 }, ansi::palette_color_t{ 200 } })(
+                ansi::line("rgb on palette"),
+                ansi::indented(ansi::line(ansi::change_style(ansi::red)("nested"), " style"))),
+            ansi::line(ansi::text_ref("back to default")));
+    };
+    static constexpr auto indented = []
+    {
+        return ansi::make_sequence(
+            ansi::indented(
+                ansi::line("one"),
+                ansi::indented(
+                    ansi::line("two"), ansi::indented(ansi::change_style(ansi::font(ansi::font_t::dim))("three")))),
+            ansi::unindent,
+            ansi::line("unindent below zero"),
+            ansi::push_style(ansi::font_style_t{ ansi::basic_color_t::green }),
+            ansi::modify_style(ansi::bold),
+            "styled text",
+            ansi::pop_style,
+            ansi::pop_style);
+    };
+    static constexpr auto text = [] { return ansi::make_sequence(ansi::text_ref("no new line")); };
+    static constexpr auto lines = [] { return ansi::make_sequence(ansi::line(), ansi::line(), ansi::line("x")); };
+
+    static constexpr auto styled_document = ansi::static_document(styled);
+    static constexpr auto indented_document = ansi::static_document(indented);
+    static constexpr auto text_document = ansi::static_document(text);
+    static constexpr auto lines_document = ansi::static_document(lines);
+    REQUIRE(styled_document.view() == render_to_string(ansi::stream_t{}(styled())));
+    REQUIRE(indented_document.view() == render_to_string(ansi::stream_t{}(indented())));
+    REQUIRE(text_document.view() == render_to_string(ansi::stream_t{}(text())));
+    REQUIRE(lines_document.view() == render_to_string(ansi::stream_t{}(lines())));
+}
+
+TEST_CASE("sanitize escapes control characters and backslashes", "[ansi3][sanitize]")
+{
+    const auto sanitized = [](std::string_view text, ansi::sanitize_mode_t mode)
+    {
+        std::string result;
+        ansi::string_sink_t sink{ result };
+        ansi::sanitize(sink, text, mode);
+        return result;
+    };
+    const std::string text = "a\\x1b\x1b[31m\\\t\xc2\x9b\xc2\xb0";
+    REQUIRE(sanitized(text, ansi::sanitize_mode_t::escape) == "a\\\\x1b\\x1b[31m\\\\\t\\xc2\\x9b\xc2\xb0");
+    REQUIRE(sanitized(text, ansi::sanitize_mode_t::strip) == "a\\x1b[31m\\\t\xc2\xb0");
+    REQUIRE(sanitized(text, ansi::sanitize_mode_t::none) == text);
+}
+
+TEST_CASE("sanitize does not let a C1 control span two text ops", "[ansi3][sanitize]")
+{
+    ansi::stream_t stream;
+    stream << ansi::text("\xC2") << ansi::text("\x9B" "31m");
+    std::string escaped;
+    ansi::render(escaped).sanitize(ansi::sanitize_mode_t::escape)(stream);
+    REQUIRE(escaped == "\\xc2\x9b" "31m");
+    std::string stripped;
+    ansi::render(stripped).sanitize(ansi::sanitize_mode_t::strip)(stream);
+    REQUIRE(stripped == "\x9b" "31m");
+}
+
+TEST_CASE("find_control finds what control_size finds", "[ansi3][sanitize]")
+{
+    // The SSE2 scan works in blocks of 64 and 16 bytes plus one byte of lookahead, so every length up to 200 is tried
+    // with each special sequence at every position.
+    const std::string_view specials[] = { "\x1b", "\x7f", "\x01", "\xc2\x80", "\xc2\x9f", "\xc2\xa0", "\xc2", "\t", "\\" };
+    const auto scalar_find = [](const char* ptr, const char* const end, bool backslash)
+    {
+        for (; ptr != end; ++ptr)
+        {
+            if (ansi::sanitize_fn::control_size(ptr, end) != 0 || (backslash && *ptr == '\\'))
+            {
+                return ptr;
+            }
+        }
+        return end;
+    };
+    const auto check = [&](const std::string& text)
+    {
+        const char* const begin = text.data();
+        const char* const end = begin + text.size();
+        REQUIRE(ansi::sanitize_fn::find_control(begin, end) == scalar_find(begin, end, false));
+        REQUIRE(ansi::sanitize_fn::find_control<true>(begin, end) == scalar_find(begin, end, true));
+    };
+    for (std::size_t size = 0; size <= 200; ++size)
+    {
+        check(std::string(size, 'a'));
+        for (const std::string_view special : specials)
+        {
+            for (std::size_t pos = 0; pos + special.size() <= size; ++pos)
+            {
+                std::string text(size, 'a');
+                text.replace(pos, special.size(), special);
+                check(text);
+            }
+        }
+    }
+}
+
+TEST_CASE("terminal_caps_t::parse_colors reads legacy and extended terminfo entries", "[ansi3][terminal]")
+{
+    for (const int magic : { 0432, 01036 })
+    {
+        REQUIRE(ansi::terminal_caps_t::parse_colors(terminfo_entry(magic, 15, 8)) == 8);
+        REQUIRE(ansi::terminal_caps_t::parse_colors(terminfo_entry(magic, 15, 256)) == 256);
+        REQUIRE(ansi::terminal_caps_t::parse_colors(terminfo_entry(magic, 15, -1)) == 0);
+        REQUIRE(ansi::terminal_caps_t::parse_colors(terminfo_entry(magic, 13, 256)) == 0);
+    }
+    REQUIRE(ansi::terminal_caps_t::parse_colors(terminfo_entry(01036, 15, 1 << 24)) == (1 << 24));
+
+    const std::string entry = terminfo_entry(0432, 15, 256);
+    // Cut inside the "colors" number, inside the header, and a wrong magic number.
+    REQUIRE(ansi::terminal_caps_t::parse_colors(std::string_view{ entry }.substr(0, entry.size() - 3)) == -1);
+    REQUIRE(ansi::terminal_caps_t::parse_colors(std::string_view{ entry }.substr(0, 11)) == -1);
+    REQUIRE(ansi::terminal_caps_t::parse_colors("") == -1);
+    REQUIRE(ansi::terminal_caps_t::parse_colors(std::string(1, '\1') + entry.substr(1)) == -1);
+}
+
+TEST_CASE("terminal_caps_t::detect checks NO_COLOR, COLORTERM, TERM, terminfo and the TERM name", "[ansi3][terminal]")
+{
+    const std::filesystem::path dir = std::filesystem::temp_directory_path() / "ferrugo-ansi-tests-terminfo";
+    std::filesystem::remove_all(dir);
+    const auto install = [&](const std::string& term, int colors)
+    {
+        std::filesystem::create_directories(dir / term.substr(0, 1));
+        std::ofstream{ dir / term.substr(0, 1) / term, std::ios::binary } << terminfo_entry(01036, 15, colors);
+    };
+    install("ferrugo-8", 8);
+    install("ferrugo-256", 256);
+    install("ferrugo-mono-256color", -1);
+    install("ferrugo-basic-256color", 8);
+    install("dumb", 256);
+    const std::string terminfo = dir.string();
+
+    const auto detect = [&](std::map<std::string, std::string> env)
+    {
+        env.emplace("TERMINFO", terminfo);
+        const auto getenv = [&](const char* name) -> const char*
+        {
+            const auto it = env.find(name);
+            return it != env.end() ? it->second.c_str() : nullptr;
+        };
+        return ansi::terminal_caps_t::detect(getenv).color_depth;
+    };
+    using ansi::color_depth_t;
+
+    REQUIRE(detect({ { "NO_COLOR", "1" }, { "COLORTERM", "truecolor" }, { "TERM", "ferrugo-256" } }) == color_depth_t::none);
+    REQUIRE(detect({ { "NO_COLOR", "" }, { "COLORTERM", "truecolor" } }) == color_depth_t::truecolor);
+    REQUIRE(detect({ { "COLORTERM", "24bit" }, { "TERM", "dumb" } }) == color_depth_t::truecolor);
+    REQUIRE(detect({ { "COLORTERM", "yes" }, { "TERM", "dumb" } }) == color_depth_t::none);
+    REQUIRE(detect({}) == color_depth_t::none);
+    REQUIRE(detect({ { "TERM", "ferrugo-8" } }) == color_depth_t::basic);
+    REQUIRE(detect({ { "TERM", "ferrugo-256" } }) == color_depth_t::palette);
+    // The terminfo entry wins over the TERM name, which is only a fallback when there is no entry.
+    REQUIRE(detect({ { "TERM", "ferrugo-mono-256color" } }) == color_depth_t::none);
+    REQUIRE(detect({ { "TERM", "ferrugo-basic-256color" } }) == color_depth_t::basic);
+    REQUIRE(detect({ { "TERM", "ferrugo-missing-256color" } }) == color_depth_t::palette);
+    REQUIRE(detect({ { "TERM", "ferrugo-missing-direct" } }) == color_depth_t::truecolor);
+    REQUIRE(detect({ { "TERM", "ferrugo-missing" } }) == color_depth_t::basic);
+
+    std::filesystem::remove_all(dir);
+}
+
+TEST_CASE("the SGR encoder writes each parameter in decimal", "[ansi3][sgr]")
+{
+    for (int value = 0; value < 256; ++value)
+    {
+        ferrugo::sgr::encoder_t encoder;
+        encoder.begin().arg(1).arg(static_cast<std::uint8_t>(value)).end();
+        REQUIRE(encoder.view() == "\033[1;" + std::to_string(value) + "m");
+    }
+    const ansi::font_style_t style{ ansi::rgb_color_t{ 255, 0, 17 }, ansi::palette_color_t{ 9 }, ansi::font_t::bold };
+    REQUIRE(
+        ansi::render_fn::change_style(ansi::font_style_t{}, style)
+        == "\033[38;2;255;0;17m\033[48;5;9m\033[22;23;24;25;27;28;29;1m");
+    REQUIRE(ansi::render_fn::change_style(style, style).empty());
+}
+
+TEST_CASE("style_transition_cache_t encodes each transition once and re-encodes overwritten slots", "[ansi3][cache]")
+{
+    const ansi::packed_font_style_t none{};
+    const ansi::packed_font_style_t red{ ansi::font_style_t{ ansi::basic_color_t::red } };
+    const ansi::packed_font_style_t bold{ ansi::font_style_t{ {}, ansi::rgb_color_t{ 1, 2, 3 }, ansi::font_t::bold } };
+    const auto expected = [](ansi::packed_font_style_t old_style, ansi::packed_font_style_t new_style)
+    { return ansi::render_fn::change_style(old_style.unpack(), new_style.unpack()); };
+
+    ansi::render_fn::style_transition_cache_t cache{ 64 };
+    REQUIRE(cache.get(none, red) == expected(none, red));
+    REQUIRE(cache.get(red, bold) == expected(red, bold));
+    REQUIRE(cache.get(none, red) == expected(none, red));
+    REQUIRE(cache.get(red, bold) == expected(red, bold));
+    REQUIRE(cache.get(red, red).empty());
+    REQUIRE(cache.m_misses == 3);
+    REQUIRE(cache.m_hits == 2);
+
+    // With a single slot every transition evicts the previous one.
+    ansi::render_fn::style_transition_cache_t collisions{ 1 };
+    const std::string first{ collisions.get(none, red) };
+    REQUIRE(collisions.get(red, bold) == expected(red, bold));
+    REQUIRE(collisions.get(none, red) == first);
+    REQUIRE(collisions.get(none, red) == first);
+    REQUIRE(collisions.m_misses == 3);
+    REQUIRE(collisions.m_hits == 1);
+
+    // Changing the color depth drops the entries encoded for the previous one.
+    collisions.set_color_depth(ansi::color_depth_t::basic);
+    const ansi::font_style_t basic_bold = ansi::downgrade(bold.unpack(), ansi::color_depth_t::basic);
+    REQUIRE(collisions.get(red, bold) == ansi::render_fn::change_style(red.unpack(), basic_bold));
+    REQUIRE(collisions.m_misses == 4);
+
+    // Renderers without a cache of their own share the thread's cache.
+    ansi::stream_t stream;
+    stream << ansi::push_style(red.unpack()) << "x" << ansi::pop_style;
+    using cache_t = ansi::render_fn::style_transition_cache_t;
+    const cache_t& shared = cache_t::thread_local_instance();
+    render_to_string(stream);
+    const std::size_t hits = shared.m_hits;
+    REQUIRE(render_to_string(stream) == "\033[31mx\033[39m");
+    REQUIRE(shared.m_hits == hits + 2);
+}
+
+TEST_CASE("packed_font_style_t keeps every color kind and font", "[ansi3][packed_font_style]")
+{
+    std::vector<ansi::color_t> colors = { ansi::default_color_t{} };
+    for (int i = 0; i < 8; ++i)
+    {
+        colors.push_back(ansi::standard_color_t{ static_cast<ansi::basic_color_t>(i) });
+        colors.push_back(ansi::bright_color_t{ static_cast<ansi::basic_color_t>(i) });
+    }
+    for (int i = 0; i < 256; i += 15)
+    {
+        colors.push_back(ansi::palette_color_t{ static_cast<std::uint8_t>(i) });
+        colors.push_back(ansi::rgb_color_t{ static_cast<std::uint8_t>(i), static_cast<std::uint8_t>(255 - i), 0x80 });
+    }
+    const ansi::font_t fonts[] = { ansi::font_t::none,
+                                   ansi::font_t::bold | ansi::font_t::italic,
+                                   ansi::font_t::standout | ansi::font_t::double_underline | ansi::font_t::hidden };
+
+    std::unordered_set<ansi::packed_font_style_t> packed_styles;
+    for (const ansi::color_t& foreground : colors)
+    {
+        for (const ansi::color_t& background : { colors.front(), colors.back() })
+        {
+            for (const ansi::font_t font : fonts)
+            {
+                const ansi::font_style_t style{ foreground, background, font };
+                const ansi::packed_font_style_t packed{ style };
+                REQUIRE(packed.unpack() == style);
+                REQUIRE(packed.foreground() == foreground);
+                REQUIRE(packed.background() == background);
+                REQUIRE(packed.font() == font);
+                REQUIRE(std::hash<ansi::font_style_t>{}(style) == std::hash<ansi::packed_font_style_t>{}(packed));
+                packed_styles.insert(packed);
+            }
+        }
+    }
+    // Distinct styles pack to distinct values.
+    REQUIRE(packed_styles.size() == colors.size() * 2 * std::size(fonts));
+}
 
-int main()
+TEST_CASE("spliced child streams keep the order of a flat concatenation", "[ansi3][stream]")
 {
+    const auto describe = [](const ansi::stream_t& stream)
+    {
+        std::ostringstream os;
+        stream.visit([&](const auto& op) { os << op << '\n'; });
+        return os.str();
+    };
+    std::mt19937 rng{ 7 };
+    std::size_t spliced = 0;
+    for (int iteration = 0; iteration < 50; ++iteration)
+    {
+        ansi::stream_t rope;
+        ansi::stream_t flat;
+        for (int part = 0; part < 6; ++part)
+        {
+            // Mixes children long enough to be spliced, short ones that are merged, nested ones and single ops.
+            ansi::stream_t child = random_stream(rng, std::uniform_int_distribution<std::size_t>{ 0, 80 }(rng));
+            if (part % 3 == 2)
+            {
+                ansi::stream_t outer = random_stream(rng, 40);
+                outer << ansi::stream_t{ child } << ansi::text("after");
+                child = std::move(outer);
+            }
+            flat << static_cast<const ansi::stream_t&>(child);
+            rope << std::move(child) << ansi::new_line;
+            flat << ansi::new_line;
+        }
+        REQUIRE(flat.m_chunks.empty());
+        spliced += rope.m_chunks.size();
+        REQUIRE(rope.size() == flat.size());
+        REQUIRE(describe(rope) == describe(flat));
+        REQUIRE(render_to_string(rope) == render_to_string(flat));
+
+        rope.flatten();
+        REQUIRE(rope.m_chunks.empty());
+        REQUIRE(describe(rope) == describe(flat));
+    }
+    REQUIRE(spliced > 50);
+}
+
+TEST_CASE("nested builders append their items directly to the stream", "[ansi3][builders]")
+{
+    const ansi::font_style_t style{ ansi::basic_color_t::green };
+    const auto build = [&]()
+    {
+        return ansi::line(ansi::indented(
+            ansi::set_style(style)("a", ansi::new_line, ansi::change_style(ansi::bold)(ansi::text_ref("b"))), "c"));
+    };
+    ansi::stream_t expected;
+    expected << ansi::indent << ansi::push_style(style) << "a" << ansi::new_line << ansi::modify_style(ansi::bold)
+             << ansi::text_ref("b") << ansi::pop_style << ansi::pop_style << "c" << ansi::unindent << ansi::new_line;
+
+    ansi::stream_t inserted;
+    inserted << "x" << build();
+    REQUIRE(inserted.m_chunks.empty());
+    REQUIRE(inserted.size() == expected.size() + 1);
+    REQUIRE(render_to_string(inserted) == "x" + render_to_string(expected));
+
+    const ansi::stream_t converted = build();
+    REQUIRE(converted.size() == expected.size());
+    REQUIRE(render_to_string(converted) == render_to_string(expected));
+
+    const auto sequence = build();
+    REQUIRE(render_to_string(ansi::stream_t{ sequence }) == render_to_string(expected));
+}
+
+TEST_CASE("style_delta_t composes and applies like the equivalent font_style_applier_t", "[ansi3][style_delta]")
+{
+    struct case_t
+    {
+        ansi::style_delta_t delta;
+        ansi::font_style_applier_t applier;
+    };
+    const case_t cases[] = {
+        { ansi::style_delta_t{}, [](ansi::font_style_t&) {} },
+        { ansi::bold, [](ansi::font_style_t& s) { s.font |= ansi::font_t::bold; } },
+        { ansi::red, [](ansi::font_style_t& s) { s.foreground = ansi::basic_color_t::red; } },
+        { ansi::bg(ansi::rgb_color_t{ 1, 2, 3 }),
+          [](ansi::font_style_t& s) { s.background = ansi::rgb_color_t{ 1, 2, 3 }; } },
+        { ansi::style_delta_t::with_font(ansi::font_t::italic, ansi::font_t::bold | ansi::font_t::underline),
+          [](ansi::font_style_t& s)
+          { s.font = (s.font & ~(ansi::font_t::bold | ansi::font_t::underline)) | ansi::font_t::italic; } },
+        { ansi::fg(ansi::palette_color_t{ 200 }) | ansi::underline,
+          [](ansi::font_style_t& s)
+          {
+              s.foreground = ansi::palette_color_t{ 200 };
+              s.font |= ansi::font_t::underline;
+          } },
+    };
+    const ansi::font_style_t styles[] = {
+        ansi::font_style_t{},
+        ansi::font_style_t{
+            ansi::basic_color_t::blue, ansi::bright_color_t{ ansi::basic_color_t::cyan }, ansi::font_t::bold },
+        ansi::font_style_t{ ansi::rgb_color_t{ 9, 8, 7 }, {}, ansi::font_t::underline | ansi::font_t::italic },
+    };
+    const auto check = [&](const ansi::style_delta_t& delta, const ansi::font_style_applier_t& applier)
+    {
+        for (const ansi::font_style_t& style : styles)
+        {
+            ansi::font_style_t expected = style;
+            applier(expected);
+            ansi::font_style_t applied = style;
+            delta(applied);
+            REQUIRE(applied == expected);
+            REQUIRE(delta.apply(ansi::packed_font_style_t{ style }).unpack() == expected);
+
+            ansi::stream_t with_delta;
+            with_delta << ansi::push_style(style) << ansi::modify_style(delta) << "x" << ansi::pop_style
+                       << ansi::pop_style;
+            ansi::stream_t with_applier;
+            with_applier << ansi::push_style(style) << ansi::modify_style(applier) << "x" << ansi::pop_style
+                         << ansi::pop_style;
+            REQUIRE(render_to_string(with_delta) == render_to_string(with_applier));
+        }
+    };
+    for (const case_t& lhs : cases)
+    {
+        check(lhs.delta, lhs.applier);
+        for (const case_t& rhs : cases)
+        {
+            check(lhs.delta | rhs.delta, lhs.applier | rhs.applier);
+            ansi::style_delta_t combined = lhs.delta;
+            combined |= rhs.delta;
+            REQUIRE(combined == (lhs.delta | rhs.delta));
+        }
+    }
+}
+
+TEST_CASE("indent_guides draws each level with its guide and restores the text style", "[ansi3][indent_guides]")
+{
+    ansi::render_fn::indent_prefix_cache_t guides{ {
+        ansi::render_fn::indent_guide_t{ "| ", ansi::font_style_t{ ansi::basic_color_t::blue } },
+        ansi::render_fn::indent_guide_t{ ". ", ansi::font_style_t{ {}, {}, ansi::font_t::dim } },
+    } };
+    REQUIRE(guides.get(0).empty());
+    REQUIRE(guides.get(1) == "\033[34m| \033[39m");
+    REQUIRE(guides.get(3) == "\033[34m| \033[39m\033[22;23;24;25;27;28;29;2m. . \033[22;23;24;25;27;28;29m");
+    REQUIRE(guides.get_plain(3) == "| . . ");
+
+    const ansi::font_style_t red{ ansi::basic_color_t::red };
+    ansi::stream_t stream;
+    stream << "a" << ansi::indent << ansi::new_line << "b" << ansi::push_style(red) << ansi::indent << ansi::new_line
+           << "c" << ansi::pop_style << ansi::unindent << ansi::unindent << ansi::new_line << "d";
+    // Each line ends in the default style; the style of the text is set again after the prefix.
+    std::string out;
+    ansi::render(out).indent_guides(guides)(stream);
+    REQUIRE(
+        out
+        == "a\033[0m\n" + std::string{ guides.get(1) } + "b\033[31m\033[0m\n" + std::string{ guides.get(2) }
+               + "\033[31mc\033[39m\033[0m\nd");
+
+    // The default renderer indents with two spaces per level.
+    REQUIRE(render_to_string(stream) == "a\033[0m\n  b\033[31m\033[0m\n    \033[31mc\033[39m\033[0m\nd");
+}
+
+TEST_CASE("render writes the same bytes into every kind of sink", "[ansi3][sink]")
+{
+    // Keeps text ops by reference until flush(), as a scatter-gather writer would.
+    struct ref_sink_t
+    {
+        std::string& m_out;
+        std::vector<std::string_view> m_pending = {};
+        std::deque<std::string> m_copies = {};
+
+        void append(const char* data, std::size_t size)
+        {
+            m_pending.push_back(m_copies.emplace_back(data, size));
+        }
+
+        void append_ref(const char* data, std::size_t size)
+        {
+            m_pending.emplace_back(data, size);
+        }
+
+        void flush()
+        {
+            for (const std::string_view part : m_pending)
+            {
+                m_out += part;
+            }
+            m_pending.clear();
+            m_copies.clear();
+        }
+    };
+    static_assert(ansi::is_sink_v<ref_sink_t> && ansi::has_append_ref_v<ref_sink_t>);
+
+    std::mt19937 rng{ 14 };
+    for (int iteration = 0; iteration < 20; ++iteration)
+    {
+        const ansi::stream_t stream = random_stream(rng, 200);
+        const std::string expected = render_to_string(stream);
+
+        std::vector<char> vector;
+        ansi::render(vector)(stream);
+        REQUIRE(std::string(vector.begin(), vector.end()) == expected);
+
+        std::ostringstream os;
+        ansi::render(os)(stream);
+        REQUIRE(os.str() == expected);
+
+        std::vector<char> storage(expected.size() + 1);
+        ansi::buffer_sink_t buffer{ storage.data(), storage.size() };
+        ansi::render(buffer)(stream);
+        REQUIRE(buffer.view() == expected);
+        REQUIRE(!buffer.overflow());
+
+        ansi::buffer_sink_t small{ storage.data(), expected.size() / 2 };
+        ansi::render(small)(stream);
+        REQUIRE(small.view() == std::string_view{ expected }.substr(0, expected.size() / 2));
+        REQUIRE(small.overflow() == !expected.empty());
+
+        std::string referenced;
+        ref_sink_t ref_sink{ referenced };
+        ansi::render(ref_sink)(stream);
+        REQUIRE(referenced == expected);
+    }
+}
+
+TEST_CASE("plain rendering writes the rendered text without escape sequences", "[ansi3][plain]")
+{
+    const auto strip_escapes = [](std::string_view text)
+    {
+        std::string result;
+        for (std::size_t i = 0; i < text.size(); ++i)
+        {
+            if (text[i] == '\033' && i + 1 < text.size() && text[i + 1] == '[')
+            {
+                // Skip the parameters up to the final byte of the control sequence.
+                for (i += 2; i < text.size() && !(text[i] >= 0x40 && text[i] <= 0x7E); ++i)
+                {
+                }
+                continue;
+            }
+            result += text[i];
+        }
+        return result;
+    };
+    std::mt19937 rng{ 19 };
+    for (int iteration = 0; iteration < 50; ++iteration)
+    {
+        const ansi::stream_t stream = random_stream(rng, 300);
+        const std::string expected = strip_escapes(render_to_string(stream));
+
+        std::string plain;
+        ansi::render.plain(plain)(stream);
+        REQUIRE(plain == expected);
+
+        std::string switched;
+        ansi::render(switched).plain()(stream);
+        REQUIRE(switched == expected);
+    }
+}
+
+TEST_CASE("renderers use the caches of the thread they render on", "[ansi3][threads]")
+{
+    using prefix_cache_t = ansi::render_fn::indent_prefix_cache_t;
+    ansi::stream_t stream;
+    stream << ansi::indent << ansi::indent << ansi::indent << ansi::new_line << "x";
+    std::string out;
+    const auto renderer = ansi::render(out);
+    std::string html;
+    const auto html_renderer = ansi::render_html(html);
+
+    std::size_t prefixes = 0;
+    bool html_prefixes = false;
+    std::thread{ [&]()
+                 {
+                     renderer(stream);
+                     prefixes = prefix_cache_t::thread_local_instance().m_prefixes.size();
+                     html_renderer(stream);
+                     html_prefixes = html_renderer.m_ctx.prefixes == &prefix_cache_t::thread_local_instance();
+                 } }
+        .join();
+    REQUIRE(out == "\033[0m\n      x");
+    REQUIRE(prefixes == 4);
+    REQUIRE(html_prefixes);
+    REQUIRE(html.substr(html.find("<pre")) == "<pre class=\"ansi\">\n      x</pre>\n");
 }
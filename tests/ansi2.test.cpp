@@ -0,0 +1,52 @@
+#include <catch2/catch_test_macros.hpp>
+#include <ferrugo/ansi2/ostream_output.hpp>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+namespace
+{
+
+// Writes text between two markers at the given indentation, either with output_t::write or one character at a time.
+std::string write_text(std::size_t indentation, std::string_view text, bool per_character)
+{
+    std::ostringstream os;
+    {
+        ansi::output_t out{ std::make_unique<ansi::ostream_output_t>(os) };
+        out.put('>').indent(indentation);
+        if (per_character)
+        {
+            for (const char ch : text)
+            {
+                ch == '\n' ? out.new_line() : out.put(static_cast<char32_t>(ch));
+            }
+        }
+        else
+        {
+            out.write(text);
+        }
+        out.unindent().put('<');
+    }
+    return os.str();
+}
+
+}  // namespace
+
+TEST_CASE("output_t::write writes line segments like single characters", "[ansi2][output]")
+{
+    REQUIRE(write_text(2, "ab\ncd\n\nef\n", false) == ">ab\n  cd\n\n  ef\n<");
+    for (const std::size_t indentation : { 0, 2, 5 })
+    {
+        for (const std::string_view text : { "", "\n", "abc", "\nabc", "a\nb", "a\n\n\nb\n", "x\ny\n\n" })
+        {
+            REQUIRE(write_text(indentation, text, false) == write_text(indentation, text, true));
+        }
+    }
+}
+
+TEST_CASE("output_t::write passes multi-byte UTF-8 through", "[ansi2][output]")
+{
+    const std::string_view text = "\xC5\xBC\xC3\xB3\xC5\x82w\n\xE2\x9C\x93";
+    REQUIRE(write_text(2, text, false) == ">\xC5\xBC\xC3\xB3\xC5\x82w\n  \xE2\x9C\x93<");
+}
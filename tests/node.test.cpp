@@ -0,0 +1,48 @@
+#include <catch2/catch_test_macros.hpp>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+#include "node.hpp"
+
+namespace
+{
+
+// Writes text after an indented prefix, with a pending new line, either with stream_t::write or with write_char.
+std::string write_text(int indentation, std::string_view text, bool per_character)
+{
+    std::ostringstream os;
+    stream_t stream{ os };
+    stream.write("a");
+    stream.increase_indent(indentation);
+    stream.tab(1);
+    stream.newline();
+    if (per_character)
+    {
+        for (const char ch : text)
+        {
+            stream.m_state = stream.write_char(ch, stream.m_state);
+        }
+    }
+    else
+    {
+        stream.write(text);
+    }
+    stream.decrease_indent();
+    stream.write("z");
+    return os.str();
+}
+
+}  // namespace
+
+TEST_CASE("stream_t::write writes line segments like write_char", "[node][stream]")
+{
+    REQUIRE(write_text(2, "ab\ncd\n\nef", false) == "a\n   ab\n   cd\n\n   efz");
+    for (const int indentation : { 0, 2, 4 })
+    {
+        for (const std::string_view text : { "", "\n", "abc", "\nabc", "a\nb", "a\n\n\nb\n", "x\ny\n\n" })
+        {
+            REQUIRE(write_text(indentation, text, false) == write_text(indentation, text, true));
+        }
+    }
+}